@@ -46,6 +46,37 @@ static int check_affinity(struct irq_info *info, cpumask_t applied_mask)
 	return cpus_equal(applied_mask, current_mask);
 }
 
+/* the affinity an irq gets for the object it is assigned to */
+void applied_affinity(struct irq_info *info, cpumask_t *mask)
+{
+	/* activate only online cpus, otherwise writing to procfs returns EOVERFLOW */
+	cpus_and(*mask, cpu_online_map, info->assigned_obj->mask);
+
+	/* a storming irq may use all of the quarantine, and nothing else */
+	if (info->flags & IRQ_FLAG_STORM) {
+		cpumask_t quarantine_mask;
+
+		cpus_and(quarantine_mask, cpu_online_map, quarantined_cpus);
+		if (!cpus_empty(quarantine_mask) && cpus_intersects(*mask, quarantine_mask))
+			*mask = quarantine_mask;
+		return;
+	}
+
+	/*
+	 * cpus set aside for heavy hitters only handle their own irq, those
+	 * of parked domains none at all, and quarantined ones only storms
+	 */
+	if (!(info->flags & IRQ_FLAG_DEDICATED)) {
+		cpumask_t pool_mask;
+
+		cpus_andnot(pool_mask, *mask, dedicated_cpus);
+		cpus_andnot(pool_mask, pool_mask, parked_cpus);
+		cpus_andnot(pool_mask, pool_mask, quarantined_cpus);
+		if (!cpus_empty(pool_mask))
+			*mask = pool_mask;
+	}
+}
+
 static void activate_mapping(struct irq_info *info, void *data __attribute__((unused)))
 {
 	char buf[PATH_MAX];
@@ -62,8 +93,7 @@ static void activate_mapping(struct irq_info *info, void *data __attribute__((un
 	if (!info->assigned_obj)
 		return;
 
-	/* activate only online cpus, otherwise writing to procfs returns EOVERFLOW */
-	cpus_and(applied_mask, cpu_online_map, info->assigned_obj->mask);
+	applied_affinity(info, &applied_mask);
 
 	/*
  	 * Don't activate anything for which we have an invalid mask 
@@ -120,6 +150,12 @@ error:
 
 		force_rebalance_irq(info, NULL);
 		break;
+	case EPERM: /* Managed by the kernel, or the chip can't move it. */
+		info->level = BALANCE_NONE;
+		info->moved = 0;
+		log(TO_CONSOLE, LOG_INFO, "IRQ %i affinity is managed by the kernel\n",
+			info->irq);
+		break;
 	default:
 		/* Any other error is considered permanent. */
 		info->level = BALANCE_NONE;
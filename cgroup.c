@@ -0,0 +1,324 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the cgroup v2 watcher.  Cpus in isolated cpuset
+ * partitions are meant for latency sensitive work and must not handle
+ * irqs.  Partitions come and go at runtime, so the whole hierarchy is
+ * watched with inotify and the balancer is told whenever the set of
+ * isolated cpus changes.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include "irqbalance.h"
+
+#define CGROUP_ROOT	"/sys/fs/cgroup"
+
+/* cpus of all valid isolated partitions when last looked */
+cpumask_t cgroup_isolated_cpus;
+
+static int inotify_fd = -1;
+static guint inotify_source;
+static int watches_exhausted;
+
+/* some irq follows a cgroup, changes to cpusets need a rebalance */
+static int colocation_in_use;
+
+static void read_partition(char *path, cpumask_t *isolated)
+{
+	char file[PATH_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	cpumask_t mask;
+	FILE *f;
+
+	snprintf(file, PATH_MAX, "%s/cpuset.cpus.partition", path);
+	f = fopen(file, "r");
+	if (!f)
+		return;
+
+	/* invalid partitions read "isolated invalid (reason)" */
+	if (getline(&line, &size, f) > 0 && !strcmp(g_strstrip(line), "isolated")) {
+		snprintf(file, PATH_MAX, "%s/cpuset.cpus.effective", path);
+		cpus_clear(mask);
+		if (!process_one_line(file, get_mask_from_cpulist, &mask))
+			cpus_or(*isolated, *isolated, mask);
+	}
+
+	free(line);
+	fclose(f);
+}
+
+/*
+ * Collect the isolated cpus below path, and make sure every directory of
+ * the hierarchy is watched.  Adding a watch twice is harmless, so new
+ * cgroups are simply picked up by walking again.
+ */
+static void walk_cgroups(char *path, cpumask_t *isolated)
+{
+	char child[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (inotify_add_watch(inotify_fd, path, IN_CREATE | IN_DELETE | IN_MODIFY) < 0 &&
+	    errno == ENOSPC && !watches_exhausted) {
+		log(TO_ALL, LOG_WARNING, "Out of inotify watches, some cpuset partitions are not watched.\n");
+		watches_exhausted = 1;
+	}
+
+	read_partition(path, isolated);
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+	while ((entry = readdir(dir))) {
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+			continue;
+		snprintf(child, PATH_MAX, "%s/%s", path, entry->d_name);
+		walk_cgroups(child, isolated);
+	}
+	closedir(dir);
+}
+
+static void scan_partitions(void)
+{
+	char path[PATH_MAX] = CGROUP_ROOT;
+	cpumask_t isolated;
+	char buffer[4096];
+
+	cpus_clear(isolated);
+	walk_cgroups(path, &isolated);
+
+	if (cpus_equal(isolated, cgroup_isolated_cpus))
+		return;
+
+	cpumask_scnprintf(buffer, 4096, isolated);
+	log(TO_ALL, LOG_INFO, "Cpus in isolated cpuset partitions: %s\n", buffer);
+	update_isolated_cpus(isolated);
+}
+
+static void get_nothing(char *line __attribute__((unused)),
+			void *data __attribute__((unused)))
+{
+}
+
+/*
+ * Effective cpus of a cgroup.  Cgroups without the cpuset controller
+ * enabled run on the cpus of their closest ancestor that has it.  The
+ * files are sampled by the collector, cgroup.controllers tells whether
+ * the cgroup is there at all.
+ */
+static int read_cgroup_cpus(const char *cgroup, cpumask_t *mask)
+{
+	char path[PATH_MAX];
+	char file[PATH_MAX + sizeof("/cpuset.cpus.effective")];
+	char *slash;
+
+	snprintf(path, PATH_MAX, "%s/%s", CGROUP_ROOT, cgroup);
+	snprintf(file, sizeof(file), "%s/cgroup.controllers", path);
+	if (read_sampled_line(file, get_nothing, NULL))
+		return -1;
+
+	for (;;) {
+		snprintf(file, sizeof(file), "%s/cpuset.cpus.effective", path);
+		cpus_clear(*mask);
+		if (!read_sampled_line(file, get_mask_from_cpulist, mask))
+			return 0;
+		slash = strrchr(path, '/');
+		if (!slash || slash - path < (int)strlen(CGROUP_ROOT))
+			return -1;
+		*slash = '\0';
+	}
+}
+
+/*
+ * Widen a set of cpus to the last level cache domains they are in.  A
+ * cache covering a whole die or package is dropped from the tree, and so
+ * is the cache of just one cpu, the die or package is the last level
+ * cache then.
+ */
+static void expand_to_cache(cpumask_t *mask)
+{
+	struct topo_obj *cpu, *obj, *llc, *die;
+	cpumask_t caches;
+	GList *entry;
+
+	cpus_copy(caches, *mask);
+	for (entry = g_list_first(cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+		if (!cpu_isset(cpu->number, *mask))
+			continue;
+		llc = die = NULL;
+		for (obj = cpu->parent; obj && obj->obj_type == OBJ_TYPE_CACHE; obj = obj->parent) {
+			if (obj->level == BALANCE_CACHE)
+				llc = obj;
+			else if (obj->level == BALANCE_DIE)
+				die = obj;
+		}
+		if (!llc || cpus_weight(llc->mask) <= 1)
+			llc = die ? die : obj;
+		if (llc)
+			cpus_or(caches, caches, llc->mask);
+	}
+	cpus_copy(*mask, caches);
+}
+
+/*
+ * Keep an irq on the cpus its cgroup has now, or the caches they are in,
+ * and move it along if the cgroup left it behind
+ */
+void colocate_irq(struct irq_info *info, cpumask_t *cgroup_cpus)
+{
+	cpumask_t mask;
+
+	cpus_and(mask, *cgroup_cpus, unbanned_cpus);
+	if (info->cgroup_scope == COLOCATE_CACHE)
+		expand_to_cache(&mask);
+
+	if (cpus_equal(mask, info->colocate_mask))
+		return;
+
+	if (cpus_empty(mask))
+		log(TO_CONSOLE, LOG_INFO, "IRQ %d: no usable cpus in cgroup %s, placing it anywhere\n",
+		    info->irq, info->cgroup);
+	info->colocate_mask = mask;
+
+	/* the cgroup moved away from where the irq is, move it along */
+	if (info->assigned_obj && outside_colocation(info, info->assigned_obj))
+		force_rebalance_irq(info, NULL);
+}
+
+static void update_irq_colocation(struct irq_info *info, void *data)
+{
+	GHashTable *seen = data;
+	cpumask_t *cgroup_cpus;
+
+	if (!info->cgroup)
+		return;
+	colocation_in_use = 1;
+
+	cgroup_cpus = g_hash_table_lookup(seen, info->cgroup);
+	if (!cgroup_cpus) {
+		cgroup_cpus = calloc(1, sizeof(cpumask_t));
+		if (!cgroup_cpus)
+			return;
+		if (read_cgroup_cpus(info->cgroup, cgroup_cpus) < 0)
+			cpus_clear(*cgroup_cpus);
+		g_hash_table_insert(seen, info->cgroup, cgroup_cpus);
+	}
+
+	colocate_irq(info, cgroup_cpus);
+}
+
+/*
+ * Refresh the cpus each co-located irq may use from the current cpusets
+ * of their cgroups
+ */
+void update_colocation(void)
+{
+	GHashTable *seen;
+
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free);
+	colocation_in_use = 0;
+	for_each_irq(NULL, update_irq_colocation, seen);
+	g_hash_table_destroy(seen);
+}
+
+static gboolean cgroup_changed(gint fd, GIOCondition condition,
+			       gpointer user_data __attribute__((unused)))
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	int relevant = 0;
+	ssize_t len;
+	char *p;
+
+	if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		inotify_source = 0;
+		return FALSE;
+	}
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)p;
+			/*
+			 * Only cgroups coming and going and writes to the
+			 * cpuset files matter, not e.g. memory.events
+			 */
+			if (event->mask & (IN_ISDIR | IN_Q_OVERFLOW))
+				relevant = 1;
+			else if (event->len && g_str_has_prefix(event->name, "cpuset.cpus"))
+				relevant = 1;
+		}
+	}
+
+	if (relevant) {
+		scan_partitions();
+		if (colocation_in_use)
+			kick_collector();
+	}
+
+	return TRUE;
+}
+
+void deinit_cgroup_watch(void)
+{
+	if (inotify_source) {
+		g_source_remove(inotify_source);
+		inotify_source = 0;
+	}
+	if (inotify_fd >= 0) {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+}
+
+/*
+ * return value: TRUE with an error; otherwise, FALSE
+ */
+gboolean init_cgroup_watch(void)
+{
+	char path[PATH_MAX] = CGROUP_ROOT;
+
+	cpus_clear(cgroup_isolated_cpus);
+
+	/* not an error, cpuset partitions need the unified hierarchy */
+	if (access(CGROUP_ROOT "/cgroup.controllers", F_OK)) {
+		log(TO_CONSOLE, LOG_INFO, "cgroup v2 is not mounted, not watching cpuset partitions.\n");
+		return FALSE;
+	}
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		log(TO_ALL, LOG_WARNING, "Failed to watch cgroups: %s\n", strerror(errno));
+		return TRUE;
+	}
+
+	walk_cgroups(path, &cgroup_isolated_cpus);
+	inotify_source = g_unix_fd_add(inotify_fd, G_IO_IN | G_IO_ERR | G_IO_HUP,
+				       cgroup_changed, NULL);
+	return FALSE;
+}
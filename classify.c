@@ -28,18 +28,33 @@ char *classes[] = {
 static int map_class_to_level[8] =
 { BALANCE_PACKAGE, BALANCE_CACHE, BALANCE_CORE, BALANCE_CORE, BALANCE_CORE, BALANCE_CORE, BALANCE_CORE, BALANCE_CORE };
 
+/* classes whose interrupts shouldn't wait for a cpu to wake up */
+static int map_class_to_latency[8] =
+{ 0, 0, 1, 0, 1, 1, 1, 0 };
+
 struct user_irq_policy {
 	int ban;
 	int level;
 	int numa_node_set;
 	int numa_node;
+	int cgroup_set;
+	int cgroup_scope;
+	int hint_policy;
+	int latency;
+	char cgroup[128];
 };
 
+char *polscript = NULL;
+int hint_policy = HINT_POLICY_IGNORE;
+
 static GList *interrupts_db = NULL;
 static GList *banned_irqs = NULL;
 GList *cl_banned_irqs = NULL;
 static GList *cl_banned_modules = NULL;
 
+/* ids of the devices owning msi irqs, by device path */
+static GHashTable *device_ids = NULL;
+
 #define SYSFS_DIR "/sys"
 #define SYSPCI_DIR "/sys/bus/pci/devices"
 
@@ -319,6 +334,76 @@ void add_cl_banned_module(char *modname)
 }
 
 			
+/*
+ * Number the devices with msi irqs, so that the queues of a multi queue
+ * device can be told apart from those of other devices
+ */
+static int get_device_id(const char *devpath)
+{
+	gpointer id;
+
+	if (!device_ids)
+		device_ids = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	id = g_hash_table_lookup(device_ids, devpath);
+	if (!id) {
+		id = GINT_TO_POINTER(g_hash_table_size(device_ids) + 1);
+		g_hash_table_insert(device_ids, strdup(devpath), id);
+	}
+
+	return GPOINTER_TO_INT(id);
+}
+
+static int get_hint_policy(struct user_irq_policy *pol)
+{
+	return (pol->hint_policy >= 0) ? pol->hint_policy : hint_policy;
+}
+
+static void get_affinity_hint(int irq, cpumask_t *mask)
+{
+	char path[PATH_MAX];
+
+	cpus_clear(*mask);
+	sprintf(path, "/proc/irq/%i/affinity_hint", irq);
+	process_one_line(path, get_mask_from_bitmap, mask);
+}
+
+/*
+ * Pin an irq to the cpus its driver hints at.  Returns 1 if it was
+ * pinned, 0 if it has no usable hint and should be balanced.
+ */
+static int apply_affinity_hint(int irq)
+{
+	char path[PATH_MAX], buf[PATH_MAX];
+	cpumask_t mask;
+	FILE *file;
+
+	get_affinity_hint(irq, &mask);
+	cpus_and(mask, mask, cpu_online_map);
+	cpus_and(mask, mask, unbanned_cpus);
+	if (cpus_empty(mask))
+		return 0;
+
+	if (dry_run) {
+		cpumask_scnprintf(buf, PATH_MAX, mask);
+		log(TO_CONSOLE, LOG_INFO, "IRQ %d would follow its affinity hint %s\n", irq, buf);
+		return 1;
+	}
+
+	sprintf(path, "/proc/irq/%i/smp_affinity", irq);
+	file = fopen(path, "w");
+	if (!file)
+		return 0;
+	cpumask_scnprintf(buf, PATH_MAX, mask);
+	if (fprintf(file, "%s", buf) < 0 || fclose(file)) {
+		log(TO_ALL, LOG_DEBUG, "Cannot apply the affinity hint of IRQ %d\n", irq);
+		return 0;
+	}
+
+	log(TO_CONSOLE, LOG_INFO, "IRQ %d follows its affinity hint %s\n", irq, buf);
+	return 1;
+}
+
 /*
  * Inserts an irq_info struct into the intterupts_db list
  * devpath points to the device directory in sysfs for the 
@@ -339,6 +424,10 @@ static struct irq_info *add_one_irq_to_db(const char *devpath, struct irq_info *
 	new->irq = irq;
 	new->type = hint->type;
 	new->class = hint->class;
+	if (hint->name)
+		new->name = strdup(hint->name);
+	if (devpath && new->type == IRQ_TYPE_MSIX)
+		new->device = get_device_id(devpath);
 
 	interrupts_db = g_list_append(interrupts_db, new);
 
@@ -358,7 +447,7 @@ static struct irq_info *add_one_irq_to_db(const char *devpath, struct irq_info *
 
 get_numa_node:
 	numa_node = NUMA_NO_NODE;
-	if (numa_avail) {
+	if (numa_avail && pol->numa_node_set != 1) {
 		if (devpath != NULL) {
 			sprintf(path, "%s/numa_node", devpath);
 			process_one_line(path, get_int, &numa_node);
@@ -378,6 +467,21 @@ get_numa_node:
 		new->numa_node = get_numa_node(NUMA_NO_NODE);
 	}
 
+	if ((pol->latency >= 0) ? pol->latency : map_class_to_latency[new->class])
+		new->flags |= IRQ_FLAG_LATENCY;
+
+	if (pol->cgroup_set == 1) {
+		new->cgroup = strdup(pol->cgroup);
+		new->cgroup_scope = (pol->cgroup_scope >= 0) ? pol->cgroup_scope : COLOCATE_CPUS;
+	}
+
+	/* only worth following if some of the hinted cpus may be used */
+	if (get_hint_policy(pol) == HINT_POLICY_SUBSET) {
+		get_affinity_hint(irq, &new->affinity_hint);
+		if (cpus_intersects(new->affinity_hint, unbanned_cpus))
+			new->hint_policy = HINT_POLICY_SUBSET;
+	}
+
 	cpus_setall(new->cpumask);
 	if (devpath != NULL) {
 		sprintf(path, "%s/local_cpus", devpath);
@@ -388,10 +492,28 @@ get_numa_node:
 	return new;
 }
 
+/*
+ * Add an irq known only by its class and node, e.g. from a recorded trace,
+ * without looking at sysfs or asking the policy script
+ */
+struct irq_info *add_irq_to_db(int irq, int class, int numa_node)
+{
+	struct irq_info hint = { .irq = irq, .type = IRQ_TYPE_MSI, .class = class };
+	struct user_irq_policy pol;
+
+	if (get_irq_info(irq))
+		return NULL;
+
+	memset(&pol, -1, sizeof(struct user_irq_policy));
+	pol.numa_node_set = 1;
+	pol.numa_node = numa_node;
+	return add_one_irq_to_db(NULL, &hint, &pol);
+}
+
 static void parse_user_policy_key(char *buf, int irq, struct user_irq_policy *pol)
 {
 	char *key, *value, *end;
-	char *levelvals[] = { "none", "package", "cache", "core" };
+	char *levelvals[] = { "none", "package", "die", "cache", "cluster", "smt", "core" };
 	int idx;
 	int key_set = 1;
 
@@ -422,12 +544,12 @@ static void parse_user_policy_key(char *buf, int irq, struct user_irq_policy *po
 			log(TO_ALL, LOG_WARNING, "Unknown value for ban policy: %s\n", value);
 		}
 	} else if (!strcasecmp("balance_level", key)) {
-		for (idx=0; idx<4; idx++) {
+		for (idx=0; idx<(int)G_N_ELEMENTS(levelvals); idx++) {
 			if (!strcasecmp(levelvals[idx], value))
 				break;
 		}
 
-		if (idx>3) {
+		if (idx>=(int)G_N_ELEMENTS(levelvals)) {
 			key_set = 0;
 			log(TO_ALL, LOG_WARNING, "Bad value for balance_level policy: %s\n", value);
 		} else
@@ -441,6 +563,45 @@ static void parse_user_policy_key(char *buf, int irq, struct user_irq_policy *po
 		}
 		pol->numa_node = idx;
 		pol->numa_node_set = 1;
+	} else if (!strcasecmp("cgroup", key)) {
+		/* relative to the cgroup v2 mount */
+		while (*value == '/')
+			value++;
+		if (!*value || strstr(value, "..")) {
+			log(TO_ALL, LOG_WARNING, "Bad value for cgroup policy: %s\n", value);
+			return;
+		}
+		snprintf(pol->cgroup, sizeof(pol->cgroup), "%s", value);
+		pol->cgroup_set = 1;
+	} else if (!strcasecmp("hint_policy", key)) {
+		if (!strcasecmp("ignore", value))
+			pol->hint_policy = HINT_POLICY_IGNORE;
+		else if (!strcasecmp("subset", value))
+			pol->hint_policy = HINT_POLICY_SUBSET;
+		else if (!strcasecmp("exact", value))
+			pol->hint_policy = HINT_POLICY_EXACT;
+		else {
+			key_set = 0;
+			log(TO_ALL, LOG_WARNING, "Bad value for hint_policy policy: %s\n", value);
+		}
+	} else if (!strcasecmp("latency_sensitive", key)) {
+		if (!strcasecmp("false", value))
+			pol->latency = 0;
+		else if (!strcasecmp("true", value))
+			pol->latency = 1;
+		else {
+			key_set = 0;
+			log(TO_ALL, LOG_WARNING, "Unknown value for latency_sensitive policy: %s\n", value);
+		}
+	} else if (!strcasecmp("cgroup_scope", key)) {
+		if (!strcasecmp("cpus", value))
+			pol->cgroup_scope = COLOCATE_CPUS;
+		else if (!strcasecmp("cache", value))
+			pol->cgroup_scope = COLOCATE_CACHE;
+		else {
+			key_set = 0;
+			log(TO_ALL, LOG_WARNING, "Bad value for cgroup_scope policy: %s\n", value);
+		}
 	} else {
 		key_set = 0;
 		log(TO_ALL, LOG_WARNING, "Unknown key returned, ignoring: %s\n", key);
@@ -609,6 +770,9 @@ static void add_new_irq(char *path, struct irq_info *hint)
 	if ((pol.ban == 1) || check_for_irq_ban(hint, mod)) { /*FIXME*/
 		add_banned_irq(irq, &banned_irqs);
 		new = get_irq_info(irq);
+	} else if (get_hint_policy(&pol) == HINT_POLICY_EXACT && apply_affinity_hint(irq)) {
+		add_banned_irq(irq, &banned_irqs);
+		new = get_irq_info(irq);
 	} else
 		new = add_one_irq_to_db(path, hint, &pol);
 
@@ -686,6 +850,9 @@ done:
 
 static void free_irq(struct irq_info *info, void *data __attribute__((unused)))
 {
+	free(info->name);
+	free(info->netdev);
+	free(info->cgroup);
 	free(info);
 }
 
@@ -699,6 +866,10 @@ void free_irq_db(void)
 	banned_irqs = NULL;
 	g_list_free(rebalance_irq_list);
 	rebalance_irq_list = NULL;
+	if (device_ids) {
+		g_hash_table_destroy(device_ids);
+		device_ids = NULL;
+	}
 }
 
 void free_cl_opts(void)
@@ -709,6 +880,11 @@ void free_cl_opts(void)
 
 static void add_missing_irq(struct irq_info *info, void *data __attribute__((unused)))
 {
+	struct irq_info *found = get_irq_info(info->irq);
+
+	/* irqs found through sysfs still want their /proc/interrupts name */
+	if (found && !found->name && info->name)
+		found->name = strdup(info->name);
 
 	add_new_irq(NULL, info);
 }
@@ -750,16 +926,18 @@ int proc_irq_hotplug(char *savedline, int irq, struct irq_info **pinfo)
 {
 	struct irq_info tmp_info = {0};
 
+	init_irq_class_and_type(savedline, &tmp_info, irq);
+
 	/* firstly, init irq info by read device info */
 	*pinfo = build_dev_irqs(irq);
 	if (*pinfo == NULL) {
 		/* secondly, init irq info by parse savedline */
-		init_irq_class_and_type(savedline, &tmp_info, irq);
 		add_new_irq(NULL, &tmp_info);
-		free(tmp_info.name);
-
 		*pinfo = get_irq_info(irq);
+	} else if (!(*pinfo)->name && tmp_info.name) {
+		(*pinfo)->name = strdup(tmp_info.name);
 	}
+	free(tmp_info.name);
 	if (*pinfo == NULL) {
 		return -1;
 	}
@@ -781,6 +959,8 @@ void rebuild_irq_db(void)
 	for_each_irq(tmp_irqs, add_missing_irq, NULL);
 	g_list_free_full(tmp_irqs, free_tmp_irqs);
 
+	map_net_queues();
+
 }
 
 void for_each_irq(GList *list, void (*cb)(struct irq_info *info, void *data), void *data)
@@ -0,0 +1,509 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the collector thread.  It samples the procfs files the
+ * balancer consumes on its own schedule and hands the raw contents to the
+ * main loop as immutable snapshots, so that parsing and placement of one
+ * cycle overlap with the kernel generating the data for the next one, and
+ * the main loop (and with it the socket handler) never blocks on procfs.
+ * The sysfs files read every interval, such as the idle state residencies,
+ * are sampled along with them.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "irqbalance.h"
+
+int sleep_interval = SLEEP_INTERVAL;
+
+static const char *proc_source_path[PROC_SOURCE_MAX] = {
+	[PROC_INTERRUPTS]	= "/proc/interrupts",
+	[PROC_STAT]		= "/proc/stat",
+	[PROC_SOFTIRQS]		= "/proc/softirqs",
+};
+
+struct proc_snapshot {
+	char *buf[PROC_SOURCE_MAX];
+	size_t len[PROC_SOURCE_MAX];
+	struct irqtrace_sample *trace;	/* measured handler times, or NULL */
+	GHashTable *files;		/* sysfs path -> first line, NULL if unreadable */
+};
+
+/*
+ * Single slot handoff between the collector (the only producer) and the
+ * main loop (the only consumer).  Both sides only ever swap the pointer, so
+ * a snapshot is owned by exactly one thread at any time.
+ */
+static struct proc_snapshot *mailbox;
+
+/* Snapshot the main loop is currently parsing, NULL to read procfs directly */
+static struct proc_snapshot *cur_snapshot;
+
+/*
+ * The sysfs files the main loop read during its last cycle are handed to
+ * the collector the same way, as a set of paths it takes over: published
+ * holds the newest set until the collector swaps it out, sampled is the
+ * set the collector keeps reading until then, wanted the set the main
+ * loop gathers for the next one.
+ */
+static GHashTable *published_files;
+static GHashTable *sampled_files;
+static GHashTable *wanted_files;
+
+static GThread *collector_thread;
+static int ready_fd = -1;	/* collector -> main loop: snapshot published */
+static int wake_fd = -1;	/* main loop -> collector: collect now or stop */
+static gint collector_stop;
+static gint collector_failed;	/* the collector quit on an error */
+
+/* run on the main loop for every snapshot published */
+static GSourceFunc snapshot_cb;
+
+/*
+ * The collector keeps the sources open and rereads them from the start
+ * with pread(), sparing an open and close of each file every interval
+ */
+static int proc_source_fd[PROC_SOURCE_MAX] = { -1, -1, -1 };
+
+/* buffer size that fit each source last time, to read it in one go */
+static size_t proc_source_size[PROC_SOURCE_MAX];
+
+static int read_proc_source(enum proc_source src, char **bufp, size_t *lenp)
+{
+	char *buf = NULL, *newbuf;
+	size_t size = proc_source_size[src], len = 0;
+	ssize_t ret;
+	int fd = proc_source_fd[src];
+
+	if (fd < 0) {
+		fd = open(proc_source_path[src], O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		proc_source_fd[src] = fd;
+	}
+
+	do {
+		if (len == size || !buf) {
+			if (len == size)
+				size = size ? size * 2 : 16384;
+			newbuf = realloc(buf, size);
+			if (!newbuf) {
+				free(buf);
+				return -1;
+			}
+			buf = newbuf;
+		}
+		ret = pread(fd, buf + len, size - len, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret > 0)
+			len += ret;
+	} while (ret > 0);
+
+	if (ret < 0) {
+		/* reopen on the next sample in case the file went stale */
+		close(fd);
+		proc_source_fd[src] = -1;
+	}
+	proc_source_size[src] = size;
+
+	if (ret < 0 || !len) {
+		free(buf);
+		return -1;
+	}
+
+	*bufp = buf;
+	*lenp = len;
+	return 0;
+}
+
+static void free_file_set(GHashTable *files)
+{
+	if (files)
+		g_hash_table_destroy(files);
+}
+
+static void free_snapshot(struct proc_snapshot *snap)
+{
+	int i;
+
+	if (!snap)
+		return;
+	for (i = 0; i < PROC_SOURCE_MAX; i++)
+		free(snap->buf[i]);
+	free_irqtrace_sample(snap->trace);
+	free_file_set(snap->files);
+	free(snap);
+}
+
+static gpointer swap_pointer(gpointer *slot, gpointer new)
+{
+	gpointer old;
+
+	do {
+		old = g_atomic_pointer_get(slot);
+	} while (!g_atomic_pointer_compare_and_exchange(slot, old, new));
+
+	return old;
+}
+
+static struct proc_snapshot *swap_mailbox(struct proc_snapshot *new)
+{
+	return swap_pointer((gpointer *)&mailbox, new);
+}
+
+static void sample_file(gpointer key, gpointer value __attribute__((unused)), gpointer data)
+{
+	struct proc_snapshot *snap = data;
+	char *path, *line = NULL;
+	size_t size = 0;
+	FILE *file;
+
+	path = strdup(key);
+	if (!path)
+		return;
+
+	file = fopen(path, "r");
+	if (file && getline(&line, &size, file) <= 0) {
+		free(line);
+		line = NULL;
+	}
+	if (file)
+		fclose(file);
+
+	g_hash_table_insert(snap->files, path, line);
+}
+
+/* read the first line of every sysfs file the main loop asked for */
+static void sample_files(struct proc_snapshot *snap)
+{
+	GHashTable *files = swap_pointer((gpointer *)&published_files, NULL);
+
+	if (files) {
+		free_file_set(sampled_files);
+		sampled_files = files;
+	}
+	if (!sampled_files)
+		return;
+
+	snap->files = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+	g_hash_table_foreach(sampled_files, sample_file, snap);
+}
+
+static struct proc_snapshot *collect_snapshot(void)
+{
+	struct proc_snapshot *snap;
+	int i;
+
+	snap = calloc(1, sizeof(struct proc_snapshot));
+	if (!snap)
+		return NULL;
+
+	for (i = 0; i < PROC_SOURCE_MAX; i++) {
+		if (read_proc_source(i, &snap->buf[i], &snap->len[i]) < 0)
+			log(TO_ALL, LOG_WARNING, "collector: failed to read %s\n",
+			    proc_source_path[i]);
+	}
+	sample_files(snap);
+
+	if (irqtrace_mode)
+		snap->trace = irqtrace_collect();
+
+	return snap;
+}
+
+static void publish_snapshot(struct proc_snapshot *snap)
+{
+	uint64_t one = 1;
+
+	/*
+	 * If the main loop hasn't picked up the previous snapshot yet it is
+	 * stale now; replace it rather than queueing behind it.
+	 */
+	free_snapshot(swap_mailbox(snap));
+
+	if (write(ready_fd, &one, sizeof(one)) < 0)
+		log(TO_ALL, LOG_WARNING, "collector: failed to signal main loop\n");
+}
+
+/*
+ * Let the main loop know the collector is gone, so that it samples procfs
+ * itself from now on rather than waiting for snapshots that never come
+ */
+static void collector_quit(void)
+{
+	uint64_t one = 1;
+
+	g_atomic_int_set(&collector_failed, 1);
+	if (write(ready_fd, &one, sizeof(one)) < 0)
+		log(TO_ALL, LOG_WARNING, "collector: failed to signal main loop\n");
+}
+
+static gpointer collector_main(gpointer data __attribute__((unused)))
+{
+	struct pollfd *pfds;
+	gint64 deadline, now;
+	uint64_t val;
+	int nfds, ret, i;
+
+	/* slot 0 is the wake fd, followed by the trace rings if any */
+	nfds = 1 + (irqtrace_mode ? irqtrace_nr_pollfds() : 0);
+	pfds = calloc(nfds, sizeof(struct pollfd));
+	if (!pfds) {
+		log(TO_ALL, LOG_WARNING, "collector: out of memory\n");
+		collector_quit();
+		return NULL;
+	}
+	pfds[0].fd = wake_fd;
+	pfds[0].events = POLLIN;
+
+	deadline = g_get_monotonic_time() + g_atomic_int_get(&sleep_interval) * G_USEC_PER_SEC;
+	while (!g_atomic_int_get(&collector_stop)) {
+		if (nfds > 1)
+			irqtrace_pollfds(&pfds[1]);
+		now = g_get_monotonic_time();
+		ret = poll(pfds, nfds, now < deadline ? (deadline - now + 999) / 1000 : 0);
+		if (ret < 0 && errno != EINTR) {
+			log(TO_ALL, LOG_WARNING, "collector: poll failed: %s\n", strerror(errno));
+			collector_quit();
+			break;
+		}
+		if (g_atomic_int_get(&collector_stop))
+			break;
+
+		/* trace rings filling up need draining mid interval */
+		for (i = 1; ret > 0 && i < nfds; i++) {
+			if (pfds[i].revents) {
+				irqtrace_drain();
+				break;
+			}
+		}
+
+		if (ret > 0 && (pfds[0].revents & POLLIN)) {
+			if (read(wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+				log(TO_ALL, LOG_WARNING, "collector: failed to read wakeup: %s\n",
+				    strerror(errno));
+				collector_quit();
+				break;
+			}
+		} else if (g_get_monotonic_time() < deadline) {
+			continue;
+		}
+
+		publish_snapshot(collect_snapshot());
+		deadline = g_get_monotonic_time() + g_atomic_int_get(&sleep_interval) * G_USEC_PER_SEC;
+	}
+
+	free(pfds);
+	free_file_set(sampled_files);
+	sampled_files = NULL;
+	for (i = 0; i < PROC_SOURCE_MAX; i++) {
+		if (proc_source_fd[i] >= 0) {
+			close(proc_source_fd[i]);
+			proc_source_fd[i] = -1;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Open one of the sampled procfs files for parsing.  Within a balancing
+ * cycle started by the collector this reads from the published snapshot,
+ * otherwise (startup and rescans) the file is read directly.
+ */
+FILE *open_proc_source(enum proc_source src)
+{
+	if (cur_snapshot) {
+		if (!cur_snapshot->buf[src])
+			return NULL;
+		return fmemopen(cur_snapshot->buf[src], cur_snapshot->len[src], "r");
+	}
+
+	return fopen(proc_source_path[src], "r");
+}
+
+/*
+ * Read the first line of a sysfs file the balancer samples every interval,
+ * like process_one_line().  Within a balancing cycle started by the
+ * collector this comes from the published snapshot once the collector
+ * knows about the file, otherwise the file is read directly.
+ */
+int read_sampled_line(char *path, void (*cb)(char *line, void *data), void *data)
+{
+	gpointer line;
+	char *copy;
+
+	/* without the collector nobody reads them ahead */
+	if (!wanted_files && !g_atomic_int_get(&collector_failed))
+		wanted_files = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+	if (wanted_files && !g_hash_table_contains(wanted_files, path)) {
+		copy = strdup(path);
+		if (copy)
+			g_hash_table_insert(wanted_files, copy, NULL);
+	}
+
+	if (!cur_snapshot || !cur_snapshot->files ||
+	    !g_hash_table_lookup_extended(cur_snapshot->files, path, NULL, &line))
+		return process_one_line(path, cb, data);
+	if (!line)
+		return -1;
+
+	/* the callback may cut the line up, keep the snapshot intact */
+	copy = strdup(line);
+	if (!copy)
+		return -1;
+	cb(copy, data);
+	free(copy);
+	return 0;
+}
+
+/* hand the sysfs files read during the cycle to the collector */
+static void publish_wanted_files(void)
+{
+	free_file_set(swap_pointer((gpointer *)&published_files, wanted_files));
+	wanted_files = NULL;
+}
+
+/*
+ * Handler times measured over the interval of the current snapshot, NULL
+ * when irq tracing is off or the cycle doesn't come from the collector.
+ */
+struct irqtrace_sample *snapshot_irqtrace(void)
+{
+	return cur_snapshot ? cur_snapshot->trace : NULL;
+}
+
+/*
+ * Drop the snapshot of the current cycle, so that further parsing reads
+ * procfs directly.  Used when the topology was rebuilt and the snapshot
+ * no longer matches it.
+ */
+void drop_snapshot(void)
+{
+	free_snapshot(cur_snapshot);
+	cur_snapshot = NULL;
+}
+
+/*
+ * Ask the collector to take its next sample right away instead of waiting
+ * for the rest of the sleep interval.
+ */
+void kick_collector(void)
+{
+	uint64_t one = 1;
+
+	if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+		log(TO_ALL, LOG_WARNING, "collector: failed to wake collector\n");
+}
+
+/* without the collector, sample procfs on the main loop every interval */
+static gboolean sample_directly(gpointer data __attribute__((unused)))
+{
+	if (snapshot_cb(NULL))
+		g_timeout_add_seconds(g_atomic_int_get(&sleep_interval), sample_directly, NULL);
+	return FALSE;
+}
+
+static gboolean snapshot_ready(gint fd, GIOCondition condition,
+			       gpointer user_data __attribute__((unused)))
+{
+	uint64_t val;
+
+	if (condition != G_IO_IN)
+		return TRUE;
+
+	if (read(fd, &val, sizeof(val)) < 0)
+		return TRUE;
+
+	cur_snapshot = swap_mailbox(NULL);
+	if (cur_snapshot) {
+		gboolean ret = snapshot_cb(NULL);
+
+		drop_snapshot();
+		publish_wanted_files();
+		if (!ret)
+			return FALSE;
+	}
+
+	/* the last snapshot and the collector quitting may come as one */
+	if (g_atomic_int_get(&collector_failed)) {
+		free_file_set(wanted_files);
+		wanted_files = NULL;
+		log(TO_ALL, LOG_WARNING, "collector: stopped, sampling procfs on the main loop\n");
+		g_timeout_add_seconds(g_atomic_int_get(&sleep_interval), sample_directly, NULL);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * return value: TRUE with an error; otherwise, FALSE
+ */
+gboolean init_collector(GSourceFunc cb)
+{
+	snapshot_cb = cb;
+	ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ready_fd < 0 || wake_fd < 0) {
+		log(TO_ALL, LOG_WARNING, "collector: failed to create eventfd.\n");
+		deinit_collector();
+		return TRUE;
+	}
+
+	g_atomic_int_set(&collector_stop, 0);
+	g_atomic_int_set(&collector_failed, 0);
+	g_unix_fd_add(ready_fd, G_IO_IN, snapshot_ready, NULL);
+	collector_thread = g_thread_new("collector", collector_main, NULL);
+
+	return FALSE;
+}
+
+void deinit_collector(void)
+{
+	if (collector_thread) {
+		g_atomic_int_set(&collector_stop, 1);
+		kick_collector();
+		g_thread_join(collector_thread);
+		collector_thread = NULL;
+	}
+
+	free_snapshot(swap_mailbox(NULL));
+	drop_snapshot();
+	free_file_set(swap_pointer((gpointer *)&published_files, NULL));
+	free_file_set(wanted_files);
+	wanted_files = NULL;
+
+	if (ready_fd >= 0) {
+		close(ready_fd);
+		ready_fd = -1;
+	}
+	if (wake_fd >= 0) {
+		close(wake_fd);
+		wake_fd = -1;
+	}
+}
@@ -0,0 +1,304 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the consolidation mode.  The powersave mode takes a
+ * single cpu at a time out of the balancing, but a package only reaches
+ * its deep idle states once none of its cpus takes interrupts.  While the
+ * irq load stays low, whole last level caches or packages are parked, and
+ * the irqs are packed onto as few of them as can carry the load, close to
+ * the nodes of their devices.  As soon as the load rises again the parked
+ * ones are given back.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "irqbalance.h"
+
+int consolidate_mode = CONSOLIDATE_OFF;
+
+/* irq load in percent of the capacity of the domains left to carry it */
+unsigned long consolidate_threshold = 20;
+
+/* cpus of the parked domains */
+cpumask_t parked_cpus;
+
+/* intervals the load has to stay low before one more domain is parked */
+#define CONSOLIDATE_SETTLE	3
+
+/* domains left to carry the irqs, 0 before the first decision */
+static int nr_active;
+static int settle_count;
+
+struct consolidate_unit {
+	struct topo_obj *obj;
+	uint64_t work;
+	uint64_t capacity;
+	unsigned int local_irqs;
+	unsigned int idle;
+	int pinned;
+};
+
+static void add_cpu_to_unit(struct topo_obj *cpu, void *data)
+{
+	struct consolidate_unit *unit = data;
+
+	if (!cpu_isset(cpu->number, unit->obj->mask))
+		return;
+
+	/* a heavy hitter's or a storm's cpu can't be parked, nor its load moved */
+	if (cpu_isset(cpu->number, dedicated_cpus) || cpu_isset(cpu->number, quarantined_cpus)) {
+		unit->pinned = 1;
+		return;
+	}
+
+	/* in ns as if at full capacity, the same whichever cpu does it */
+	unit->work += cpu->load * cpu->capacity / CAPACITY_SCALE;
+	unit->capacity += stat_interval * cpu->capacity / CAPACITY_SCALE;
+}
+
+/* by count rather than load, which follows where the irqs were placed */
+static void count_local_irq(struct irq_info *info, void *data)
+{
+	struct consolidate_unit *unit = data;
+	struct topo_obj *node = irq_numa_node(info);
+
+	if (node->number != NUMA_NO_NODE && cpus_intersects(node->mask, unit->obj->mask))
+		unit->local_irqs++;
+}
+
+static void add_unit(struct topo_obj *d, void *data)
+{
+	GList **units = data;
+	struct consolidate_unit *unit;
+
+	unit = calloc(1, sizeof(struct consolidate_unit));
+	if (!unit)
+		return;
+	unit->obj = d;
+	unit->idle = d->idle;
+	for_each_object(cpus, add_cpu_to_unit, unit);
+	if (numa_avail)
+		for_each_irq(NULL, count_local_irq, unit);
+
+	*units = g_list_append(*units, unit);
+}
+
+static int has_cache_domain(struct topo_obj *d)
+{
+	GList *entry;
+	struct topo_obj *child;
+
+	for (entry = g_list_first(d->children); entry; entry = g_list_next(entry)) {
+		child = entry->data;
+		if (child->obj_type != OBJ_TYPE_CACHE)
+			continue;
+		if (child->level == BALANCE_CACHE || has_cache_domain(child))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The last level caches are the outermost cache domains below a package.
+ * Where there is none, the cache spans all of the object above, as when
+ * it was dropped for covering the whole package or die.  Dies, clusters
+ * and physical cores in between aren't parked on their own.
+ */
+static void add_cache_units(struct topo_obj *d, void *data)
+{
+	if ((d->obj_type == OBJ_TYPE_CACHE && d->level == BALANCE_CACHE) ||
+	    !has_cache_domain(d)) {
+		add_unit(d, data);
+		return;
+	}
+	for_each_object(d->children, add_cache_units, data);
+}
+
+/*
+ * The domains that should keep taking irqs come first: those with heavy
+ * hitters, then those already active, so that parking never swaps one
+ * domain for another, then those close to the most devices, and those
+ * awake anyway, so that the ones able to go idle are parked
+ */
+static gint compare_units(gconstpointer a, gconstpointer b)
+{
+	const struct consolidate_unit *ua = a, *ub = b;
+
+	if (ua->pinned != ub->pinned)
+		return ub->pinned - ua->pinned;
+	if (ua->obj->powersave_mode != ub->obj->powersave_mode)
+		return ua->obj->powersave_mode - ub->obj->powersave_mode;
+	if (ua->local_irqs != ub->local_irqs)
+		return ua->local_irqs < ub->local_irqs ? 1 : -1;
+	if (ua->idle != ub->idle)
+		return ua->idle < ub->idle ? -1 : 1;
+	return ua->obj->number - ub->obj->number;
+}
+
+/* the fewest domains at the front of the list to carry work at percent of them */
+static int units_needed(GList *units, uint64_t work, unsigned long percent)
+{
+	struct consolidate_unit *unit;
+	uint64_t capacity = 0;
+	GList *entry;
+	int needed = 0;
+
+	for (entry = g_list_first(units); entry; entry = g_list_next(entry)) {
+		unit = entry->data;
+		capacity += unit->capacity;
+		needed++;
+		if (work * 100 <= capacity * percent)
+			break;
+	}
+	return needed;
+}
+
+static void evacuate_obj(struct topo_obj *d, void *data __attribute__((unused)))
+{
+	if (d->interrupts)
+		for_each_irq(d->interrupts, force_rebalance_irq, NULL);
+	for_each_object(d->children, evacuate_obj, NULL);
+}
+
+static void spread_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	if (!(info->flags & (IRQ_FLAG_DEDICATED | IRQ_FLAG_STORM)))
+		force_rebalance_irq(info, NULL);
+}
+
+/*
+ * irqs balanced over cpus that were just parked or given back need their
+ * affinity rewritten, even if they stay where they are
+ */
+static void refresh_affinity(struct irq_info *info, void *data)
+{
+	cpumask_t *changed = data;
+
+	if (info->assigned_obj && cpus_intersects(info->assigned_obj->mask, *changed))
+		info->moved = 1;
+}
+
+/* a node all of whose cpus are parked takes no irqs either */
+static void update_node(struct topo_obj *node, void *data __attribute__((unused)))
+{
+	cpumask_t usable;
+
+	cpus_and(usable, node->mask, unbanned_cpus);
+	node->powersave_mode = node->number != NUMA_NO_NODE && !cpus_empty(parked_cpus) &&
+			       cpus_subset(usable, parked_cpus);
+}
+
+static void reset_consolidation(void)
+{
+	cpus_clear(parked_cpus);
+	for_each_object(numa_nodes, update_node, NULL);
+	nr_active = 0;
+	settle_count = 0;
+}
+
+/*
+ * Decide how many last level caches or packages the irqs need, and park
+ * the rest.  Parking goes one domain at a time and only after the load
+ * stayed low for a few intervals, while a rise in load gives back all
+ * the domains it needs at once.  Called every interval, once the load of
+ * the irqs is known.
+ */
+void update_consolidation(void)
+{
+	struct consolidate_unit *unit;
+	GList *units = NULL, *entry;
+	cpumask_t old, changed;
+	uint64_t work = 0;
+	int nr_units, needed, i;
+
+	if (consolidate_mode == CONSOLIDATE_OFF || !stat_interval)
+		return;
+
+	/* the tree was rebuilt, every domain starts out active */
+	if (!cycle_count)
+		reset_consolidation();
+
+	if (consolidate_mode == CONSOLIDATE_PACKAGE)
+		for_each_object(packages, add_unit, &units);
+	else
+		for_each_object(packages, add_cache_units, &units);
+
+	units = g_list_sort(units, compare_units);
+	nr_units = g_list_length(units);
+	for (entry = g_list_first(units); entry; entry = g_list_next(entry))
+		work += ((struct consolidate_unit *)entry->data)->work;
+
+	if (!nr_active || nr_active > nr_units)
+		nr_active = nr_units;
+
+	/* park with a margin, so that the load settles well below the threshold */
+	needed = units_needed(units, work, consolidate_threshold);
+	if (needed > nr_active) {
+		log(TO_ALL, LOG_INFO, "irq load rising, expanding to %d of %d domains\n",
+		    needed, nr_units);
+		nr_active = needed;
+		settle_count = 0;
+		for_each_irq(NULL, spread_irq, NULL);
+	} else if (units_needed(units, work, consolidate_threshold * 3 / 4) < nr_active) {
+		if (++settle_count >= CONSOLIDATE_SETTLE) {
+			nr_active--;
+			settle_count = 0;
+			log(TO_ALL, LOG_INFO, "irq load low, consolidating onto %d of %d domains\n",
+			    nr_active, nr_units);
+		}
+	} else {
+		settle_count = 0;
+	}
+
+	cpus_copy(old, parked_cpus);
+	cpus_clear(parked_cpus);
+	i = 0;
+	for (entry = g_list_first(units); entry; entry = g_list_next(entry), i++) {
+		unit = entry->data;
+		log(TO_CONSOLE, LOG_INFO, "%s%d: work %" PRIu64 " capacity %" PRIu64
+		    " local %u idle %u%s\n",
+		    unit->obj->obj_type == OBJ_TYPE_PACKAGE ? "package " :
+		    unit->obj->obj_type == OBJ_TYPE_CPU ? "cpu " : "cache domain ",
+		    unit->obj->number, unit->work, unit->capacity, unit->local_irqs,
+		    unit->idle, i < nr_active ? "" : " parked");
+
+		if (i < nr_active) {
+			unit->obj->powersave_mode = 0;
+			continue;
+		}
+
+		if (!unit->obj->powersave_mode) {
+			unit->obj->powersave_mode = 1;
+			evacuate_obj(unit->obj, NULL);
+		}
+		cpus_or(parked_cpus, parked_cpus, unit->obj->mask);
+	}
+	g_list_free_full(units, free);
+
+	for_each_object(numa_nodes, update_node, NULL);
+
+	cpus_xor(changed, old, parked_cpus);
+	if (!cpus_empty(changed))
+		for_each_irq(NULL, refresh_affinity, &changed);
+}
@@ -0,0 +1,232 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the interrupt cost model.  Every cycle each cpu gives
+ * one sample of how much irq time it spent against how many interrupts of
+ * each class it handled.  A least squares fit over these samples, with old
+ * cycles fading out, estimates what a single interrupt of each class costs,
+ * so that the load of an object can be split between its irqs by cost
+ * rather than by plain interrupt count.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "irqbalance.h"
+
+/* one coefficient per class plus a constant per cpu baseline */
+#define COST_TERMS	(IRQ_CLASSES + 1)
+#define COST_BASELINE	IRQ_CLASSES
+
+/* weight of the previous cycles' samples, roughly a 50 cycle window */
+#define COST_DECAY	0.98L
+
+/* cycles of samples needed before the fit is trusted */
+#define COST_MIN_CYCLES	10
+
+static long double xtx[COST_TERMS][COST_TERMS];
+static long double xty[COST_TERMS];
+static long double cost[COST_TERMS];
+static int fitted[COST_TERMS];
+static int cycles;
+
+/* per class weight used to split load, 1 for all until the fit is usable */
+static uint64_t class_weight[IRQ_CLASSES] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+
+/*
+ * Solve the normal equations restricted to the terms in use by gaussian
+ * elimination.  A small ridge keeps classes that always fire together
+ * from making the system singular.
+ */
+static int solve_terms(int *use, long double *x)
+{
+	long double a[COST_TERMS][COST_TERMS + 1];
+	int idx[COST_TERMS];
+	int n = 0, i, j, k, p;
+
+	for (i = 0; i < COST_TERMS; i++)
+		if (use[i])
+			idx[n++] = i;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++)
+			a[i][j] = xtx[idx[i]][idx[j]];
+		a[i][i] += a[i][i] * 1e-6L + 1e-9L;
+		a[i][n] = xty[idx[i]];
+	}
+
+	for (k = 0; k < n; k++) {
+		p = k;
+		for (i = k + 1; i < n; i++)
+			if (a[i][k] * a[i][k] > a[p][k] * a[p][k])
+				p = i;
+		if (a[p][k] == 0)
+			return -1;
+		if (p != k) {
+			for (j = k; j <= n; j++) {
+				long double t = a[k][j];
+				a[k][j] = a[p][j];
+				a[p][j] = t;
+			}
+		}
+		for (i = k + 1; i < n; i++) {
+			long double f = a[i][k] / a[k][k];
+			for (j = k; j <= n; j++)
+				a[i][j] -= f * a[k][j];
+		}
+	}
+
+	for (i = n - 1; i >= 0; i--) {
+		long double v = a[i][n];
+		for (j = i + 1; j < n; j++)
+			v -= a[i][j] * x[idx[j]];
+		x[idx[i]] = v / a[i][i];
+	}
+
+	return 0;
+}
+
+/*
+ * Refit the coefficients.  A negative cost makes no sense, so any term
+ * that comes out negative is dropped and the rest is fitted again.
+ */
+static void fit_cost_model(void)
+{
+	long double x[COST_TERMS];
+	long double sum = 0;
+	int use[COST_TERMS];
+	int i, again, nr_fitted = 0;
+
+	for (i = 0; i < COST_TERMS; i++)
+		use[i] = (xtx[i][i] > 0);
+
+	do {
+		memset(x, 0, sizeof(x));
+		if (solve_terms(use, x) < 0)
+			return;
+		again = 0;
+		for (i = 0; i < COST_TERMS; i++) {
+			if (use[i] && x[i] < 0) {
+				use[i] = 0;
+				again = 1;
+			}
+		}
+	} while (again);
+
+	for (i = 0; i < COST_TERMS; i++) {
+		cost[i] = use[i] ? x[i] : 0;
+		fitted[i] = use[i] && x[i] > 0;
+	}
+
+	if (cycles < COST_MIN_CYCLES)
+		return;
+
+	for (i = 0; i < IRQ_CLASSES; i++) {
+		if (fitted[i]) {
+			sum += cost[i];
+			nr_fitted++;
+		}
+	}
+	if (!nr_fitted)
+		return;
+
+	/* classes without a usable fit are assumed to cost the average */
+	for (i = 0; i < IRQ_CLASSES; i++)
+		class_weight[i] = MAX(1, (uint64_t)((fitted[i] ? cost[i] : sum / nr_fitted) + 0.5L));
+}
+
+/*
+ * Feed the interrupt counts and load of the last interval of every cpu
+ * into the model.  Called after the cpu loads have been updated.
+ */
+void update_cost_model(void)
+{
+	long double x[COST_TERMS];
+	struct topo_obj *cpu;
+	GList *entry;
+	int i, j, class, samples = 0;
+
+	for (i = 0; i < COST_TERMS; i++) {
+		xty[i] *= COST_DECAY;
+		for (j = 0; j < COST_TERMS; j++)
+			xtx[i][j] *= COST_DECAY;
+	}
+
+	for (entry = g_list_first(cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+
+		for (class = 0; class < IRQ_CLASSES; class++) {
+			uint64_t count = cpu->class_irq_count[class];
+
+			x[class] = (count >= cpu->last_class_irq_count[class]) ?
+				count - cpu->last_class_irq_count[class] : 0;
+			cpu->last_class_irq_count[class] = count;
+		}
+		x[COST_BASELINE] = 1;
+
+		if (!cycle_count)
+			continue;
+
+		for (i = 0; i < COST_TERMS; i++) {
+			xty[i] += x[i] * cpu->load;
+			for (j = 0; j < COST_TERMS; j++)
+				xtx[i][j] += x[i] * x[j];
+		}
+		samples++;
+	}
+
+	if (!samples)
+		return;
+
+	cycles++;
+	fit_cost_model();
+}
+
+/*
+ * Relative cost of one interrupt of this irq, used to weigh interrupt
+ * counts when sharing out the load of an object
+ */
+uint64_t irq_cost_weight(struct irq_info *info)
+{
+	if (info->class < 0 || info->class >= IRQ_CLASSES)
+		return class_weight[IRQ_OTHER];
+	return class_weight[info->class];
+}
+
+void dump_cost_model(void)
+{
+	int class;
+
+	log(TO_CONSOLE, LOG_INFO, "Interrupt cost model (%d cycles%s):\n", cycles,
+	    cycles < COST_MIN_CYCLES ? ", not in use yet" : "");
+	for (class = 0; class < IRQ_CLASSES; class++) {
+		if (fitted[class])
+			log(TO_CONSOLE, LOG_INFO, "%s%-16s %.0Lf ns per interrupt (weight %lu)\n",
+			    log_indent, classes[class], cost[class],
+			    (unsigned long)class_weight[class]);
+		else
+			log(TO_CONSOLE, LOG_INFO, "%s%-16s not fitted (weight %lu)\n",
+			    log_indent, classes[class], (unsigned long)class_weight[class]);
+	}
+	log(TO_CONSOLE, LOG_INFO, "%s%-16s %.0Lf ns per cpu\n", log_indent, "baseline",
+	    cost[COST_BASELINE]);
+}
@@ -0,0 +1,151 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file tracks the frequency the cpus run at.  A ns of irq time at a
+ * low frequency is less work than one at the top frequency, and the work
+ * is what moves with an irq, so the load read from /proc/stat is scaled
+ * by the current over the maximum frequency of the cpu.  The average
+ * frequency over the interval comes from the APERF and MPERF counters
+ * where the msr driver gives access to them, the current one from cpufreq
+ * otherwise.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "irqbalance.h"
+
+#define MSR_IA32_MPERF	0xe7
+#define MSR_IA32_APERF	0xe8
+
+/* msr device of each cpu, opened while irqbalance still may */
+static int msr_fd[NR_CPUS];
+static int msr_opened;
+
+static void get_u64(char *line, void *data)
+{
+	*(uint64_t *)data = strtoull(line, NULL, 10);
+}
+
+/*
+ * Files read every interval are sampled by the collector, those read once
+ * drop out of its set again after a cycle
+ */
+static uint64_t read_cpufreq(int cpunr, const char *file)
+{
+	char path[PATH_MAX];
+	uint64_t freq = 0;
+
+	snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpunr, file);
+	read_sampled_line(path, get_u64, &freq);
+	return freq;
+}
+
+static int read_msr(int cpunr, off_t msr, uint64_t *val)
+{
+	if (!msr_opened || msr_fd[cpunr] < 0)
+		return -1;
+	return pread(msr_fd[cpunr], val, sizeof(*val), msr) == sizeof(*val) ? 0 : -1;
+}
+
+/*
+ * The average frequency while not idle over the last interval, from the
+ * counters ticking at the actual and at the base frequency
+ */
+static uint64_t read_busy_freq(struct topo_obj *cpu)
+{
+	uint64_t aperf, mperf, freq = 0;
+
+	if (!cpu->base_freq || read_msr(cpu->number, MSR_IA32_APERF, &aperf) ||
+	    read_msr(cpu->number, MSR_IA32_MPERF, &mperf))
+		return 0;
+
+	if (cpu->last_mperf && mperf > cpu->last_mperf && aperf >= cpu->last_aperf)
+		freq = (aperf - cpu->last_aperf) * cpu->base_freq / (mperf - cpu->last_mperf);
+
+	cpu->last_aperf = aperf;
+	cpu->last_mperf = mperf;
+	return freq;
+}
+
+static void update_freq_scale(struct topo_obj *cpu, void *data __attribute__((unused)))
+{
+	uint64_t freq;
+
+	/* the limits don't change, unlike the policy's scaling_max_freq */
+	if (!cpu->max_freq) {
+		cpu->max_freq = read_cpufreq(cpu->number, "cpuinfo_max_freq");
+		cpu->base_freq = read_cpufreq(cpu->number, "base_frequency");
+	}
+
+	if (!cpu->max_freq) {
+		cpu->freq_scale = CAPACITY_SCALE;
+		return;
+	}
+
+	freq = read_busy_freq(cpu);
+	if (!freq)
+		freq = read_cpufreq(cpu->number, "scaling_cur_freq");
+
+	/* turbo may go past the advertised maximum */
+	cpu->freq_scale = freq ? MIN(freq * CAPACITY_SCALE / cpu->max_freq, CAPACITY_SCALE) :
+				 CAPACITY_SCALE;
+}
+
+/* sample the frequency of all cpus for the interval that just ended */
+void update_cpufreq(void)
+{
+	for_each_object(cpus, update_freq_scale, NULL);
+}
+
+/*
+ * Reading the msrs needs CAP_SYS_RAWIO, so the devices are opened before
+ * dropping privileges.  Cpus coming online later use cpufreq only.
+ */
+void init_cpufreq(void)
+{
+	char path[PATH_MAX];
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		msr_fd[cpu] = -1;
+		if (!cpu_isset(cpu, cpu_online_map))
+			continue;
+		snprintf(path, PATH_MAX, "/dev/cpu/%d/msr", cpu);
+		msr_fd[cpu] = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	msr_opened = 1;
+}
+
+void deinit_cpufreq(void)
+{
+	int cpu;
+
+	if (!msr_opened)
+		return;
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (msr_fd[cpu] >= 0)
+			close(msr_fd[cpu]);
+	}
+	msr_opened = 0;
+}
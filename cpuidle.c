@@ -0,0 +1,131 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file samples the idle states of the cpus.  An interrupt arriving
+ * at a cpu in a deep idle state waits for the cpu to wake up first, so
+ * from the time each cpu spent in each state during the last interval
+ * and the exit latency of the states follows the latency an interrupt
+ * can expect on it.  Latency sensitive irqs are kept on cpus that are
+ * awake anyway, the consolidation mode parks the domains that sleep.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "irqbalance.h"
+
+/* expected wakeup latency in us above which a cpu counts as asleep, 0 is off */
+unsigned long wake_latency_threshold = 0;
+
+static void get_u64(char *line, void *data)
+{
+	*(uint64_t *)data = strtoull(line, NULL, 10);
+}
+
+static void sample_cpu_idle(struct topo_obj *cpu, void *data)
+{
+	uint64_t interval = *(uint64_t *)data;
+	uint64_t residency, latency, delta, idle = 0, wait = 0;
+	char path[PATH_MAX];
+	int state, sampled = 0;
+
+	for (state = 0; state < CPUIDLE_STATES; state++) {
+		snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/time",
+			 cpu->number, state);
+		if (read_sampled_line(path, get_u64, &residency))
+			break;
+		snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/latency",
+			 cpu->number, state);
+		latency = 0;
+		read_sampled_line(path, get_u64, &latency);
+
+		/* nothing to compare to right after the cpu was added */
+		if (cpu->last_idle_time[state])
+			sampled = 1;
+		delta = residency > cpu->last_idle_time[state] ? residency - cpu->last_idle_time[state] : 0;
+		cpu->last_idle_time[state] = residency;
+
+		/* state0 is polling on most systems, the cpu doesn't sleep */
+		if (state)
+			idle += delta;
+		wait += delta * latency;
+	}
+
+	if (!sampled || !interval) {
+		cpu->idle = 0;
+		cpu->wake_latency = 0;
+		return;
+	}
+
+	cpu->idle = MIN(idle * 1000 / interval, 1000);
+	cpu->wake_latency = wait / interval;
+}
+
+/*
+ * Average the idle residency and wakeup latency of the cpus below d,
+ * return how many cpus there are
+ */
+static int average_idle(struct topo_obj *d, uint64_t *idle, uint64_t *latency)
+{
+	uint64_t sum_idle = 0, sum_latency = 0;
+	GList *entry;
+	int count = 0;
+
+	if (d->obj_type == OBJ_TYPE_CPU) {
+		*idle += d->idle;
+		*latency += d->wake_latency;
+		return 1;
+	}
+
+	for (entry = g_list_first(d->children); entry; entry = g_list_next(entry))
+		count += average_idle(entry->data, &sum_idle, &sum_latency);
+
+	d->idle = count ? sum_idle / count : 0;
+	d->wake_latency = count ? sum_latency / count : 0;
+	*idle += sum_idle;
+	*latency += sum_latency;
+	return count;
+}
+
+/* average the idle residency and wakeup latency of the cpus up the tree */
+void average_cpuidle(void)
+{
+	uint64_t idle = 0, latency = 0;
+	GList *entry;
+
+	for (entry = g_list_first(numa_nodes); entry; entry = g_list_next(entry))
+		average_idle(entry->data, &idle, &latency);
+}
+
+/*
+ * Sample the idle states of all cpus over the last interval, as read by
+ * the collector.  Only done when something looks at them.
+ */
+void update_cpuidle(void)
+{
+	uint64_t interval = stat_interval / 1000;
+
+	if (!wake_latency_threshold && consolidate_mode == CONSOLIDATE_OFF)
+		return;
+
+	for_each_object(cpus, sample_cpu_idle, &interval);
+	average_cpuidle();
+}
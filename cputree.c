@@ -40,10 +40,16 @@
 #include "irqbalance.h"
 #include "thermal.h"
 
-#ifdef HAVE_IRQBALANCEUI
-extern char *banned_cpumask_from_ui;
-#endif
-extern char *cpu_ban_string;
+int debug_mode;
+int journal_logging = 0;
+unsigned int log_mask = TO_ALL;
+const char *log_indent;
+
+int need_rebuild;
+/* level of the largest data cache to build domains for, L2 as ever */
+unsigned long deepest_cache = 2;
+char *cpu_ban_string = NULL;
+char *banned_cpumask_from_ui = NULL;
 
 GList *cpus;
 GList *cache_domains;
@@ -51,6 +57,13 @@ GList *packages;
 
 int cache_domain_count;
 
+/* the banned cpus were given by the user rather than detected */
+static int manual_banned_cpus;
+
+/* cpus indexed by their number, for lookups from the per cpu stats */
+static struct topo_obj *cpu_index[NR_CPUS];
+static int cpu_count;
+
 /* Users want to be able to keep interrupts away from some cpus; store these in a cpumask_t */
 cpumask_t banned_cpus;
 
@@ -97,7 +110,7 @@ void get_mask_from_bitmap(char *line, void *mask)
 	cpumask_parse_user(line, strlen(line), *(cpumask_t *)mask);
 }
 
-static void get_mask_from_cpulist(char *line, void *mask)
+void get_mask_from_cpulist(char *line, void *mask)
 {
 	if (strlen(line) && line[0] != '\n')
 		cpulist_parse(line, strlen(line), *(cpumask_t *)mask);
@@ -116,6 +129,8 @@ static void setup_banned_cpus(void)
 	cpumask_t isolated_cpus;
 	char *env = NULL;
 
+	manual_banned_cpus = 1;
+
 #ifdef HAVE_IRQBALANCEUI
 	/* A manually specified cpumask overrides auto-detection. */
 	if (cpu_ban_string != NULL && banned_cpumask_from_ui != NULL) {
@@ -157,11 +172,15 @@ static void setup_banned_cpus(void)
 	process_one_line(path, get_mask_from_cpulist, &nohz_full);
 
 	cpus_or(banned_cpus, nohz_full, isolated_cpus);
+	cpus_or(banned_cpus, banned_cpus, cgroup_isolated_cpus);
+	manual_banned_cpus = 0;
 
 	cpumask_scnprintf(buffer, 4096, isolated_cpus);
 	log(TO_CONSOLE, LOG_INFO, "Prevent irq assignment to these isolated CPUs: %s\n", buffer);
 	cpumask_scnprintf(buffer, 4096, nohz_full);
 	log(TO_CONSOLE, LOG_INFO, "Prevent irq assignment to these adaptive-ticks CPUs: %s\n", buffer);
+	cpumask_scnprintf(buffer, 4096, cgroup_isolated_cpus);
+	log(TO_CONSOLE, LOG_INFO, "Prevent irq assignment to these cpuset-isolated CPUs: %s\n", buffer);
 out:
 #ifdef HAVE_THERMAL
 	cpus_or(banned_cpus, banned_cpus, thermal_banned_cpus);
@@ -222,6 +241,7 @@ static struct topo_obj* add_cache_domain_to_package(struct topo_obj *cache,
 		}
 		package->mask = package_mask;
 		package->obj_type = OBJ_TYPE_PACKAGE;
+		package->level = BALANCE_PACKAGE;
 		package->obj_type_list = &packages;
 		package->number = packageid;
 		packages = g_list_append(packages, package);
@@ -238,9 +258,9 @@ static struct topo_obj* add_cache_domain_to_package(struct topo_obj *cache,
 
 	return package;
 }
-static struct topo_obj* add_cpu_to_cache_domain(struct topo_obj *cpu,
-						    cpumask_t cache_mask,
-						    int nodeid)
+static struct topo_obj* add_obj_to_cache_domain(struct topo_obj *child,
+						struct cpu_domain *domain,
+						int nodeid)
 {
 	GList *entry;
 	struct topo_obj *cache;
@@ -249,7 +269,7 @@ static struct topo_obj* add_cpu_to_cache_domain(struct topo_obj *cpu,
 
 	while (entry) {
 		cache = entry->data;
-		if (cpus_equal(cache_mask, cache->mask))
+		if (cpus_equal(domain->mask, cache->mask))
 			break;
 		entry = g_list_next(entry);
 	}
@@ -261,17 +281,19 @@ static struct topo_obj* add_cpu_to_cache_domain(struct topo_obj *cpu,
 			return NULL;
 		}
 		cache->obj_type = OBJ_TYPE_CACHE;
-		cache->mask = cache_mask;
+		cache->level = domain->level;
+		cache->cache_level = domain->cache_level;
+		cache->mask = domain->mask;
 		cache->number = cache_domain_count;
 		cache->obj_type_list = &cache_domains;
 		cache_domains = g_list_append(cache_domains, cache);
 		cache_domain_count++;
 	}
 
-	entry = g_list_find(cache->children, cpu);
+	entry = g_list_find(cache->children, child);
 	if (!entry) {
-		cache->children = g_list_append(cache->children, cpu);
-		cpu->parent = cache;
+		cache->children = g_list_append(cache->children, child);
+		child->parent = cache;
 	}
 
 	if (!numa_avail || (nodeid > NUMA_NO_NODE))
@@ -280,33 +302,150 @@ static struct topo_obj* add_cpu_to_cache_domain(struct topo_obj *cpu,
 	return cache;
 }
 
-#define ADJ_SIZE(r,s) PATH_MAX-strlen(r)-strlen(#s) 
-static void do_one_cpu(char *path)
+static void get_cache_type(char *line, void *data)
+{
+	*(int *)data = g_str_has_prefix(line, "Instruction");
+}
+
+static void add_domain_from_file(char *path, char *file, int level, int cache_level,
+				 struct cpu_domain *domains, int *nr_domains)
 {
-	struct topo_obj *cpu;
 	char new_path[PATH_MAX];
-	char *online_path ="/sys/devices/system/cpu/online";
-	cpumask_t cache_mask, package_mask;
-	struct topo_obj *cache;
-	DIR *dir;
-	struct dirent *entry;
-	int nodeid;
-	int packageid = 0;
-	unsigned int max_cache_index, cache_index, cache_stat;
-	cpumask_t online_cpus;
-	char *cpunrptr = NULL;
-	int cpunr = -1;
+	struct cpu_domain *domain = &domains[*nr_domains];
 
-	/* skip offline cpus */
-	cpus_clear(online_cpus);
-	process_one_line(online_path, get_mask_from_cpulist, &online_cpus);
-	/* Get the current cpu number from the path */
-	cpunrptr = rindex(path, '/');
-	cpunrptr += 4;
-	cpunr = atoi(cpunrptr);
-	if (!cpu_isset(cpunr, online_cpus))
+	if (*nr_domains >= MAX_CPU_DOMAINS)
+		return;
+
+	snprintf(new_path, PATH_MAX, "%s/%s", path, file);
+	cpus_clear(domain->mask);
+	if (process_one_line(new_path, get_mask_from_bitmap, &domain->mask))
 		return;
 
+	domain->level = level;
+	domain->cache_level = cache_level;
+	(*nr_domains)++;
+}
+
+/*
+ * Collect every set of cpus this cpu shares a die, a cluster, a data cache
+ * or a physical core with
+ */
+static int read_cpu_domains(char *path, struct cpu_domain *domains)
+{
+	char new_path[PATH_MAX];
+	int nr_domains = 0;
+	int cache_index, cache_level, instruction;
+
+	/* first, so a physical core wins over a cache of the same cpus */
+	add_domain_from_file(path, "topology/thread_siblings", BALANCE_SMT, 0,
+			     domains, &nr_domains);
+	add_domain_from_file(path, "topology/die_cpus", BALANCE_DIE, 0,
+			     domains, &nr_domains);
+
+	for (cache_index = 0; ; cache_index++) {
+		snprintf(new_path, PATH_MAX, "%s/cache/index%d/level", path, cache_index);
+		if (process_one_line(new_path, get_int, &cache_level))
+			break;
+
+		instruction = 0;
+		snprintf(new_path, PATH_MAX, "%s/cache/index%d/type", path, cache_index);
+		process_one_line(new_path, get_cache_type, &instruction);
+		if (instruction)
+			continue;
+
+		snprintf(new_path, PATH_MAX, "cache/index%d/shared_cpu_map", cache_index);
+		add_domain_from_file(path, new_path, BALANCE_CACHE, cache_level,
+				     domains, &nr_domains);
+	}
+
+	add_domain_from_file(path, "topology/cluster_cpus", BALANCE_CLUSTER, 0,
+			     domains, &nr_domains);
+
+	return nr_domains;
+}
+
+/*
+ * Reduce the domains of a cpu to a chain of strictly nested sets, from the
+ * largest to the smallest, inside the package.  Caches beyond the deepest
+ * cache level, levels that span the whole package or only this cpu, and
+ * levels that repeat or cross the one above add nothing to balance between
+ * and are dropped.  The last level cache is always kept, cgroup scopes and
+ * consolidation work on it whatever the deepest cache level.
+ */
+static int build_domain_chain(struct cpu_domain *domains, int nr_domains,
+			      cpumask_t package_mask, int cpunr)
+{
+	struct cpu_domain tmp;
+	cpumask_t *outer = &package_mask;
+	int i, j, nr_chain = 0;
+	int last_level = 0;
+
+	for (i = 0; i < nr_domains; i++) {
+		cpus_and(domains[i].mask, domains[i].mask, package_mask);
+		cpus_and(domains[i].mask, domains[i].mask, unbanned_cpus);
+		if (domains[i].level == BALANCE_CACHE &&
+		    domains[i].cache_level > last_level)
+			last_level = domains[i].cache_level;
+	}
+
+	/* stable sort by size, so a die wins over an equal cache and so on */
+	for (i = 1; i < nr_domains; i++) {
+		tmp = domains[i];
+		for (j = i; j > 0 && cpus_weight(domains[j - 1].mask) < cpus_weight(tmp.mask); j--)
+			domains[j] = domains[j - 1];
+		domains[j] = tmp;
+	}
+
+	for (i = 0; i < nr_domains; i++) {
+		if (!cpu_isset(cpunr, domains[i].mask) ||
+		    (domains[i].level == BALANCE_CACHE &&
+		     domains[i].cache_level > (int)deepest_cache &&
+		     domains[i].cache_level < last_level) ||
+		    cpus_weight(domains[i].mask) <= 1 ||
+		    cpus_equal(domains[i].mask, *outer) ||
+		    !cpus_subset(domains[i].mask, *outer))
+			continue;
+		domains[nr_chain++] = domains[i];
+		outer = &domains[nr_chain - 1].mask;
+	}
+
+	return nr_chain;
+}
+
+#define ADJ_SIZE(r,s) PATH_MAX-strlen(r)-strlen(#s) 
+/*
+ * Capacity of a cpu out of CAPACITY_SCALE.  The last thermal event for
+ * the cpu wins over the static capacity of asymmetric systems in sysfs.
+ */
+static unsigned int get_cpu_capacity(int cpunr)
+{
+	char path[PATH_MAX];
+	int capacity = CAPACITY_SCALE;
+
+	if (thermal_cpu_capacity(cpunr))
+		return MIN(thermal_cpu_capacity(cpunr), CAPACITY_SCALE);
+
+	snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpunr);
+	process_one_line(path, get_int, &capacity);
+	if (capacity <= 0 || capacity > CAPACITY_SCALE)
+		capacity = CAPACITY_SCALE;
+
+	return capacity;
+}
+
+/*
+ * Add a cpu to the tree, linking it up through its domains to its package
+ * and numa node.  This is the part of building the tree that doesn't read
+ * sysfs, so that the cpus may as well come from a description of another
+ * machine.
+ */
+void add_cpu_to_tree(struct cpu_desc *desc)
+{
+	struct topo_obj *cpu;
+	struct topo_obj *cache;
+	cpumask_t package_mask = desc->package_mask;
+	int nr_domains, i;
+
 	cpu = calloc(1, sizeof(struct topo_obj));
 	if (!cpu) {
 		need_rebuild = 1;
@@ -314,67 +453,109 @@ static void do_one_cpu(char *path)
 	}
 
 	cpu->obj_type = OBJ_TYPE_CPU;
+	cpu->level = BALANCE_CORE;
 
-	cpu->number = cpunr;
+	cpu->number = desc->number;
+	cpu->max_capacity = desc->capacity;
+	cpu->capacity = cpu->max_capacity;
+	cpu->avail = CAPACITY_SCALE;
+	cpu->freq_scale = CAPACITY_SCALE;
 
 	cpu_set(cpu->number, cpu_online_map);
 	
 	cpu_set(cpu->number, cpu->mask);
 
-	/*
- 	 * Default the cache_domain mask to be equal to the cpu
- 	 */
-	cpus_clear(cache_mask);
-	cpu_set(cpu->number, cache_mask);
-
 	/* if the cpu is on the banned list, just don't add it */
 	if (cpus_intersects(cpu->mask, banned_cpus)) {
 		free(cpu);
 		return;
 	}
 
+	if (numa_avail) {
+		struct topo_obj *node;
+
+		/*
+		 * In case of multiple NUMA nodes within a CPU package,
+		 * we override package_mask with node mask.
+		 */
+		node = get_numa_node(desc->node);
+		if (node && (cpus_weight(package_mask) > cpus_weight(node->mask)))
+			cpus_and(package_mask, package_mask, node->mask);
+	}
+
+	/*
+	   blank out the banned cpus from the various masks so that interrupts
+	   will never be told to go there
+	 */
+	cpus_and(package_mask, package_mask, unbanned_cpus);
+	nr_domains = build_domain_chain(desc->domains, desc->nr_domains, package_mask,
+					cpu->number);
+
+	/*
+ 	 * Without any shared level default to a cache domain of just the cpu
+ 	 */
+	if (!nr_domains) {
+		cpus_clear(desc->domains[0].mask);
+		cpu_set(cpu->number, desc->domains[0].mask);
+		desc->domains[0].level = BALANCE_CACHE;
+		desc->domains[0].cache_level = 0;
+		nr_domains = 1;
+	}
+
+	/* link the chain from the cpu up to the package */
+	cache = cpu;
+	for (i = nr_domains - 1; cache && i >= 0; i--)
+		cache = add_obj_to_cache_domain(cache, &desc->domains[i], desc->node);
+	if (cache)
+		add_cache_domain_to_package(cache, desc->package, package_mask, desc->node);
+
+	cpu->obj_type_list = &cpus;
+	cpus = g_list_append(cpus, cpu);
+	cpu_index[cpu->number] = cpu;
+	cpu_count++;
+}
+
+static void do_one_cpu(char *path)
+{
+	struct cpu_desc desc;
+	char new_path[PATH_MAX];
+	char *online_path ="/sys/devices/system/cpu/online";
+	DIR *dir;
+	struct dirent *entry;
+	cpumask_t online_cpus;
+	char *cpunrptr = NULL;
+
+	/* skip offline cpus */
+	cpus_clear(online_cpus);
+	process_one_line(online_path, get_mask_from_cpulist, &online_cpus);
+	/* Get the current cpu number from the path */
+	cpunrptr = rindex(path, '/');
+	cpunrptr += 4;
+	desc.number = atoi(cpunrptr);
+	if (!cpu_isset(desc.number, online_cpus))
+		return;
+
+	desc.capacity = get_cpu_capacity(desc.number);
+
 	/* try to read the package mask; if it doesn't exist assume solitary */
 	snprintf(new_path, ADJ_SIZE(path, "/topology/core_siblings"),
 		 "%s/topology/core_siblings", path);
-	if (process_one_line(new_path, get_mask_from_bitmap, &package_mask)) {
-		cpus_clear(package_mask);
-		cpu_set(cpu->number, package_mask);
+	if (process_one_line(new_path, get_mask_from_bitmap, &desc.package_mask)) {
+		cpus_clear(desc.package_mask);
+		cpu_set(desc.number, desc.package_mask);
 	}
 
 	/* try to read the package id */
+	desc.package = 0;
 	snprintf(new_path, ADJ_SIZE(path, "/topology/physical_package_id"),
 		 "%s/topology/physical_package_id", path);
-	process_one_line(new_path, get_int, &packageid);
+	process_one_line(new_path, get_int, &desc.package);
 
-	/* try to read the cache mask; if it doesn't exist assume solitary */
-	/* We want the deepest cache level available */
-	max_cache_index = 0;
-	cache_index = 1;
-	do {
-		struct stat sb;
-		/* Extra 10 subtraction is for the max character length of %d */
-		snprintf(new_path, ADJ_SIZE(path, "/cache/index%d/shared_cpu_map") - 10,
-			 "%s/cache/index%d/shared_cpu_map", path, cache_index);
-		cache_stat = stat(new_path, &sb);
-		if (!cache_stat) {
-			max_cache_index = cache_index;
-			if (max_cache_index == deepest_cache)
-				break;
-			cache_index ++;
-		}
-	} while(!cache_stat);
-
-	if (max_cache_index > 0) {
-		/* Extra 10 subtraction is for the max character length of %d */
-		snprintf(new_path, ADJ_SIZE(path, "/cache/index%d/shared_cpu_map") - 10,
-			 "%s/cache/index%d/shared_cpu_map", path, max_cache_index);
-		process_one_line(new_path, get_mask_from_bitmap, &cache_mask);
-	}
+	/* the dies, caches and clusters this cpu shares with others */
+	desc.nr_domains = read_cpu_domains(path, desc.domains);
 
-	nodeid = NUMA_NO_NODE;
+	desc.node = NUMA_NO_NODE;
 	if (numa_avail) {
-		struct topo_obj *node;
-
 		dir = opendir(path);
 		while (dir) {
 			entry = readdir(dir);
@@ -385,36 +566,16 @@ static void do_one_cpu(char *path)
 				int num;
 				num = strtol(entry->d_name + 4, &end, 10);
 				if (!*end && num >= 0) {
-					nodeid = num;
+					desc.node = num;
 					break;
 				}
 			}
 		}
 		if (dir)
 			closedir(dir);
-
-		/*
-		 * In case of multiple NUMA nodes within a CPU package,
-		 * we override package_mask with node mask.
-		 */
-		node = get_numa_node(nodeid);
-		if (node && (cpus_weight(package_mask) > cpus_weight(node->mask)))
-			cpus_and(package_mask, package_mask, node->mask);
 	}
 
-	/*
-	   blank out the banned cpus from the various masks so that interrupts
-	   will never be told to go there
-	 */
-	cpus_and(cache_mask, cache_mask, unbanned_cpus);
-	cpus_and(package_mask, package_mask, unbanned_cpus);
-
-	cache = add_cpu_to_cache_domain(cpu, cache_mask, nodeid);
-	if (cache)
-		add_cache_domain_to_package(cache, packageid, package_mask, nodeid);
-
-	cpu->obj_type_list = &cpus;
-	cpus = g_list_append(cpus, cpu);
+	add_cpu_to_tree(&desc);
 }
 
 static void dump_irq(struct irq_info *info, void *data)
@@ -439,30 +600,61 @@ static void dump_numa_node_num(struct topo_obj *p, void *data __attribute__((unu
 	log(TO_CONSOLE, LOG_INFO, "%d ", p->number);
 }
 
-static void dump_balance_obj(struct topo_obj *d, void *data __attribute__((unused)))
+static void dump_indent(long depth)
+{
+	long i;
+
+	for (i = 0; i < depth; i++)
+		log(TO_CONSOLE, LOG_INFO, "%s", log_indent);
+}
+
+static void dump_balance_obj(struct topo_obj *d, void *data)
 {
 	struct topo_obj *c = d;
-	log(TO_CONSOLE, LOG_INFO, "%s%s%s%sCPU number %i  numa_node is ",
-	    log_indent, log_indent, log_indent, log_indent, c->number);
+	long depth = (long)data;
+
+	dump_indent(depth);
+	log(TO_CONSOLE, LOG_INFO, "CPU number %i  numa_node is ", c->number);
 	for_each_object(cpu_numa_node(c), dump_numa_node_num, NULL);
-	log(TO_CONSOLE, LOG_INFO, "(load %lu)\n", (unsigned long)c->load);
+	log(TO_CONSOLE, LOG_INFO, "(load %lu, net softirq %lu, block softirq %lu, capacity %u, available %u, frequency %u)\n",
+	    (unsigned long)c->load, (unsigned long)c->softirq_load[SOFTIRQ_NET],
+	    (unsigned long)c->softirq_load[SOFTIRQ_BLOCK], c->capacity, c->avail, c->freq_scale);
 	if (c->interrupts)
-		for_each_irq(c->interrupts, dump_irq, (void *)18);
+		for_each_irq(c->interrupts, dump_irq, (void *)(depth * strlen(log_indent) + 2));
 }
 
 static void dump_cache_domain(struct topo_obj *d, void *data)
 {
-	char *buffer = data;
+	char buffer[4096];
+	long depth = (long)data;
+	GList *entry;
+
 	cpumask_scnprintf(buffer, 4095, d->mask);
-	log(TO_CONSOLE, LOG_INFO, "%s%sCache domain %i:  numa_node is ",
-	    log_indent, log_indent, d->number);
+	dump_indent(depth);
+	if (d->level == BALANCE_DIE)
+		log(TO_CONSOLE, LOG_INFO, "Die %i:  numa_node is ", d->number);
+	else if (d->level == BALANCE_CLUSTER)
+		log(TO_CONSOLE, LOG_INFO, "Cluster %i:  numa_node is ", d->number);
+	else if (d->level == BALANCE_SMT)
+		log(TO_CONSOLE, LOG_INFO, "Core %i:  numa_node is ", d->number);
+	else if (d->cache_level)
+		log(TO_CONSOLE, LOG_INFO, "Cache domain %i (L%d):  numa_node is ",
+		    d->number, d->cache_level);
+	else
+		log(TO_CONSOLE, LOG_INFO, "Cache domain %i:  numa_node is ", d->number);
 	for_each_object(d->numa_nodes, dump_numa_node_num, NULL);
 	log(TO_CONSOLE, LOG_INFO, "cpu mask is %s  (load %lu) \n", buffer,
 	    (unsigned long)d->load);
-	if (d->children)
-		for_each_object(d->children, dump_balance_obj, NULL);
+	for (entry = g_list_first(d->children); entry; entry = g_list_next(entry)) {
+		struct topo_obj *child = entry->data;
+
+		if (child->obj_type == OBJ_TYPE_CPU)
+			dump_balance_obj(child, (void *)(depth + 2));
+		else
+			dump_cache_domain(child, (void *)(depth + 1));
+	}
 	if (g_list_length(d->interrupts) > 0)
-		for_each_irq(d->interrupts, dump_irq, (void *)10);
+		for_each_irq(d->interrupts, dump_irq, (void *)(depth * strlen(log_indent) + 2));
 }
 
 static void dump_package(struct topo_obj *d, void *data)
@@ -474,7 +666,7 @@ static void dump_package(struct topo_obj *d, void *data)
 	log(TO_CONSOLE, LOG_INFO, "cpu mask is %s (load %lu)\n",
 	    buffer, (unsigned long)d->load);
 	if (d->children)
-		for_each_object(d->children, dump_cache_domain, buffer);
+		for_each_object(d->children, dump_cache_domain, (void *)2);
 	if (g_list_length(d->interrupts) > 0)
 		for_each_irq(d->interrupts, dump_irq, (void *)2);
 }
@@ -507,6 +699,99 @@ void clear_work_stats(void)
 }
 
 
+static gint compare_domain_size(gconstpointer a, gconstpointer b)
+{
+	const struct topo_obj *ai = a;
+	const struct topo_obj *bi = b;
+
+	return cpus_weight(bi->mask) - cpus_weight(ai->mask);
+}
+
+/*
+ * Call cb for the domains of each kind, e.g. all L3 domains, then all
+ * clusters, so that loads are only ever compared between peers
+ */
+void for_each_domain_tier(void (*cb)(GList *tier, void *data), void *data)
+{
+	GList *entry, *next, *tier, *done = NULL;
+	struct topo_obj *d, *peer;
+
+	for (entry = g_list_first(cache_domains); entry; entry = g_list_next(entry)) {
+		d = entry->data;
+		if (g_list_find(done, d))
+			continue;
+
+		tier = NULL;
+		for (next = entry; next; next = g_list_next(next)) {
+			peer = next->data;
+			if (peer->level == d->level && peer->cache_level == d->cache_level)
+				tier = g_list_append(tier, peer);
+		}
+		cb(tier, data);
+		done = g_list_concat(done, tier);
+	}
+	g_list_free(done);
+}
+
+/*
+ * Average the capacity and availability of the cpus below d, return how
+ * many cpus there are
+ */
+static int sum_capacity(struct topo_obj *d, uint64_t *capacity, uint64_t *avail)
+{
+	uint64_t sum_cap = 0, sum_avail = 0;
+	GList *entry;
+	int count = 0;
+
+	if (d->obj_type == OBJ_TYPE_CPU) {
+		d->capacity = MAX(d->max_capacity * d->avail / CAPACITY_SCALE, 1);
+		*capacity += d->capacity;
+		*avail += d->avail;
+		return 1;
+	}
+
+	for (entry = g_list_first(d->children); entry; entry = g_list_next(entry))
+		count += sum_capacity(entry->data, &sum_cap, &sum_avail);
+
+	d->capacity = count ? MAX(sum_cap / count, 1) : CAPACITY_SCALE;
+	d->avail = count ? sum_avail / count : CAPACITY_SCALE;
+	*capacity += sum_cap;
+	*avail += sum_avail;
+	return count;
+}
+
+/*
+ * Recompute the capacity of every object, after the tree was built or
+ * the capacity or availability of some cpus changed
+ */
+void update_capacity(void)
+{
+	uint64_t capacity = 0, avail = 0;
+	GList *entry;
+
+	for (entry = g_list_first(numa_nodes); entry; entry = g_list_next(entry))
+		sum_capacity(entry->data, &capacity, &avail);
+}
+
+/*
+ * Pick up a new capacity of a cpu in place.  update_capacity() must
+ * follow once all changed cpus are updated.
+ */
+void update_cpu_capacity(int cpunr)
+{
+	struct topo_obj *cpu = find_cpu_core(cpunr);
+	unsigned int capacity;
+
+	if (!cpu)
+		return;
+
+	capacity = get_cpu_capacity(cpunr);
+	if (capacity != cpu->max_capacity)
+		log(TO_CONSOLE, LOG_INFO, "CPU %d capacity changed from %u to %u\n",
+		    cpunr, cpu->max_capacity, capacity);
+	cpu->max_capacity = capacity;
+}
+
 void parse_cpu_tree(void)
 {
 	DIR *dir;
@@ -536,11 +821,24 @@ void parse_cpu_tree(void)
 		}
 	} while (entry);
 	closedir(dir);
+
+	finish_cpu_tree();
+}
+
+/*
+ * Once all cpus are added, hang the packages off their numa nodes and
+ * work out the capacity of every object
+ */
+void finish_cpu_tree(void)
+{
 	for_each_object(packages, connect_cpu_mem_topo, NULL);
 
+	/* outer domains first, so placement can walk the list top down */
+	cache_domains = g_list_sort(cache_domains, compare_domain_size);
+	update_capacity();
+
 	if (debug_mode)
 		dump_tree();
-
 }
 
 void free_cpu_topo(gpointer data)
@@ -568,31 +866,125 @@ void clear_cpu_tree(void)
 
 	g_list_free_full(cpus, free_cpu_topo);
 	cpus = NULL;
+	memset(cpu_index, 0, sizeof(cpu_index));
+	cpu_count = 0;
 	cpus_clear(cpu_online_map);
 }
 
-static gint compare_cpus(gconstpointer a, gconstpointer b)
+static void evacuate_irq(struct irq_info *info, void *data __attribute__((unused)))
 {
-	const struct topo_obj *ai = a;
-	const struct topo_obj *bi = b;
+	if (info->level == BALANCE_NONE)
+		info->assigned_obj = NULL;
+	else
+		migrate_irq_obj(info->assigned_obj, NULL, info);
+}
 
-	return ai->number - bi->number;	
+static void reapply_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	info->moved = 1;
 }
 
-struct topo_obj *find_cpu_core(int cpunr)
+/*
+ * Unlink an object from the tree, along with any parent left without
+ * children.  Its irqs go back to the rebalance list.
+ */
+static void remove_topo_obj(struct topo_obj *obj)
 {
+	struct topo_obj *parent = obj->parent;
 	GList *entry;
-	struct topo_obj find;
 
-	find.number = cpunr;
-	entry = g_list_find_custom(cpus, &find, compare_cpus);
+	if (obj->interrupts)
+		for_each_irq(obj->interrupts, evacuate_irq, NULL);
+
+	for (entry = g_list_first(obj->numa_nodes); entry; entry = g_list_next(entry)) {
+		struct topo_obj *node = entry->data;
+
+		node->children = g_list_remove(node->children, obj);
+	}
+	if (parent)
+		parent->children = g_list_remove(parent->children, obj);
+	*obj->obj_type_list = g_list_remove(*obj->obj_type_list, obj);
+
+	if (obj->obj_type == OBJ_TYPE_CPU) {
+		cpu_index[obj->number] = NULL;
+		cpu_count--;
+	}
+	free_cpu_topo(obj);
+
+	if (parent && parent->obj_type != OBJ_TYPE_NODE && !parent->children)
+		remove_topo_obj(parent);
+}
+
+static void drop_isolated_cpus(struct topo_obj *d, void *data)
+{
+	cpumask_t *isolated = data;
+
+	if (!cpus_intersects(d->mask, *isolated))
+		return;
+
+	/* irqs left on the object must not reach the isolated cpus anymore */
+	cpus_andnot(d->mask, d->mask, *isolated);
+	if (d->interrupts)
+		for_each_irq(d->interrupts, reapply_irq, NULL);
+}
+
+/*
+ * Follow a change of the cpus in isolated cpuset partitions.  Newly
+ * isolated cpus are taken out of the tree and the node masks in place,
+ * and only the irqs that could run on them are moved.  Cpus leaving a
+ * partition have to be added back to the tree, which takes a rescan.
+ */
+void update_isolated_cpus(cpumask_t isolated)
+{
+	cpumask_t added, removed;
+	struct topo_obj *cpu;
+	GList *entry, *next;
+
+	cpus_andnot(added, isolated, cgroup_isolated_cpus);
+	cpus_andnot(removed, cgroup_isolated_cpus, isolated);
+	cgroup_isolated_cpus = isolated;
+
+	if (manual_banned_cpus)
+		return;
 
-	return entry ? entry->data : NULL;
-}	
+	if (!cpus_empty(removed)) {
+		need_rescan = 1;
+		kick_collector();
+		return;
+	}
+
+	cpus_andnot(added, added, banned_cpus);
+	if (cpus_empty(added))
+		return;
+
+	cpus_or(banned_cpus, banned_cpus, added);
+	cpus_complement(unbanned_cpus, banned_cpus);
+
+	for (entry = g_list_first(cpus); entry; entry = next) {
+		next = g_list_next(entry);
+		cpu = entry->data;
+		if (cpu_isset(cpu->number, added))
+			remove_topo_obj(cpu);
+	}
+	for_each_object(cache_domains, drop_isolated_cpus, &added);
+	for_each_object(packages, drop_isolated_cpus, &added);
+	for_each_object(numa_nodes, drop_isolated_cpus, &added);
+
+	update_capacity();
+	kick_collector();
+}
+
+struct topo_obj *find_cpu_core(int cpunr)
+{
+	if (cpunr < 0 || cpunr >= NR_CPUS)
+		return NULL;
+
+	return cpu_index[cpunr];
+}
 
 int get_cpu_count(void)
 {
-	return g_list_length(cpus);
+	return cpu_count;
 }
 
 static void clear_obj_slots(struct topo_obj *d, void *data __attribute__((unused)))
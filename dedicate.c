@@ -0,0 +1,208 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the dedicated core mode.  An irq keeping a good part
+ * of a core busy on its own gains nothing from sharing that core, and the
+ * irqs it shares it with suffer.  Such heavy hitters each get a cpu of
+ * their own, which is taken out of the pool the other irqs are balanced
+ * over until the heavy hitter calms down again.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "irqbalance.h"
+
+/* share of a core in percent that makes an irq a heavy hitter, 0 is off */
+unsigned long dedicate_threshold = 0;
+
+/* cpus set aside for heavy hitters */
+cpumask_t dedicated_cpus;
+
+struct dedicated_choice {
+	struct irq_info *info;
+	struct topo_obj *best;
+	uint64_t best_cost;
+	int best_local;
+};
+
+static void update_core_share(struct irq_info *info, void *data __attribute__((unused)))
+{
+	uint64_t share;
+
+	share = MIN(info->load * CAPACITY_SCALE / stat_interval, CAPACITY_SCALE);
+	/* bursts don't make a heavy hitter, smooth it over a few intervals */
+	info->core_share = (info->core_share + share) / 2;
+}
+
+static void release_cpu(struct irq_info *info, const char *why)
+{
+	log(TO_CONSOLE, LOG_INFO, "IRQ %d %s, releasing cpu %d\n", info->irq, why,
+	    info->dedicated_cpu);
+	info->flags &= ~IRQ_FLAG_DEDICATED;
+}
+
+static void check_dedication(struct irq_info *info, void *data)
+{
+	cpumask_t *mask = data;
+	struct topo_obj *cpu = info->assigned_obj;
+
+	if (!(info->flags & IRQ_FLAG_DEDICATED))
+		return;
+
+	/* moved away by a rebuild of the tree or a policy change */
+	if (!cpu || cpu->obj_type != OBJ_TYPE_CPU || cpu->number != info->dedicated_cpu) {
+		release_cpu(info, "moved");
+		return;
+	}
+
+	/* some hysteresis, so that irqs around the threshold don't flap */
+	if (info->core_share < dedicate_threshold * CAPACITY_SCALE * 3 / 400) {
+		release_cpu(info, "calmed down");
+		force_rebalance_irq(info, NULL);
+		return;
+	}
+
+	cpu_set(cpu->number, *mask);
+}
+
+static void collect_heavy_hitter(struct irq_info *info, void *data)
+{
+	GList **heavy = data;
+
+	if (info->level == BALANCE_NONE || (info->flags & (IRQ_FLAG_DEDICATED | IRQ_FLAG_STORM)))
+		return;
+	if (info->core_share >= dedicate_threshold * CAPACITY_SCALE / 100)
+		*heavy = g_list_append(*heavy, info);
+}
+
+static gint compare_core_share(gconstpointer a, gconstpointer b)
+{
+	const struct irq_info *ia = a, *ib = b;
+
+	return (ia->core_share < ib->core_share) - (ia->core_share > ib->core_share);
+}
+
+static void find_dedicated_cpu(struct topo_obj *cpu, void *data)
+{
+	struct dedicated_choice *choice = data;
+	struct irq_info *info = choice->info;
+	uint64_t cost;
+	int local;
+
+	if (cpu_isset(cpu->number, dedicated_cpus) || cpu_isset(cpu->number, parked_cpus) ||
+	    cpu_isset(cpu->number, quarantined_cpus) || cpu->slots_left <= 0)
+		return;
+
+	if (misses_colocation(info, cpu))
+		return;
+
+	/* the cpu's load without the irq itself, so that it may stay put */
+	cost = obj_cost(cpu);
+	if (cpu == info->assigned_obj)
+		cost -= MIN(cost, info->load);
+	cost = capacity_load(cpu, cost);
+
+	local = cpu_isset(cpu->number, irq_numa_node(info)->mask);
+	if (local < choice->best_local)
+		return;
+	if (local == choice->best_local && cost >= choice->best_cost)
+		return;
+
+	choice->best = cpu;
+	choice->best_cost = cost;
+	choice->best_local = local;
+}
+
+static void evict_irq(struct irq_info *info, void *data)
+{
+	if (info != data)
+		force_rebalance_irq(info, NULL);
+}
+
+static void dedicate_cpu(struct irq_info *info)
+{
+	struct dedicated_choice choice = { info, NULL, ULLONG_MAX, 0 };
+
+	for_each_object(cpus, find_dedicated_cpu, &choice);
+	if (!choice.best)
+		return;
+
+	if (choice.best->interrupts)
+		for_each_irq(choice.best->interrupts, evict_irq, info);
+	migrate_irq_obj(NULL, choice.best, info);
+
+	info->flags |= IRQ_FLAG_DEDICATED;
+	info->dedicated_cpu = choice.best->number;
+	cpu_set(info->dedicated_cpu, dedicated_cpus);
+	log(TO_CONSOLE, LOG_INFO, "IRQ %d keeps %u%% of a core busy, dedicating cpu %d to it\n",
+	    info->irq, info->core_share * 100 / CAPACITY_SCALE, info->dedicated_cpu);
+}
+
+/*
+ * irqs balanced over cpus that were just set aside or given back need
+ * their affinity rewritten, even if they stay where they are
+ */
+static void refresh_affinity(struct irq_info *info, void *data)
+{
+	cpumask_t *changed = data;
+
+	if (info->assigned_obj && !(info->flags & IRQ_FLAG_DEDICATED) &&
+	    cpus_intersects(info->assigned_obj->mask, *changed))
+		info->moved = 1;
+}
+
+/*
+ * Give heavy hitters a cpu of their own, and return the cpus of those
+ * that calmed down to the pool.  Called every interval, once the load of
+ * the irqs is known.
+ */
+void update_dedicated_cpus(void)
+{
+	cpumask_t old, changed;
+	GList *heavy = NULL, *entry;
+
+	if (!dedicate_threshold || !stat_interval)
+		return;
+
+	for_each_irq(NULL, update_core_share, NULL);
+
+	cpus_copy(old, dedicated_cpus);
+	cpus_clear(dedicated_cpus);
+	for_each_irq(NULL, check_dedication, &dedicated_cpus);
+
+	for_each_irq(NULL, collect_heavy_hitter, &heavy);
+	heavy = g_list_sort(heavy, compare_core_share);
+	for (entry = heavy; entry; entry = g_list_next(entry)) {
+		/* always leave a cpu for the other irqs */
+		if (get_cpu_count() - cpus_weight(dedicated_cpus) <= 1) {
+			log(TO_CONSOLE, LOG_INFO, "No cpu left to dedicate to IRQ %d\n",
+			    ((struct irq_info *)entry->data)->irq);
+			break;
+		}
+		dedicate_cpu(entry->data);
+	}
+	g_list_free(heavy);
+
+	cpus_xor(changed, old, dedicated_cpus);
+	if (!cpus_empty(changed))
+		for_each_irq(NULL, refresh_affinity, &changed);
+}
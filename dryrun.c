@@ -0,0 +1,243 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the dry run mode.  Instead of writing the placement
+ * to procfs, it is compared to the affinity the irqs have right now, and
+ * the load each object would see afterwards is predicted from the load
+ * measured this interval.  Nothing on the system is changed, which makes
+ * it safe to see what irqbalance would do with a given set of options.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#include "irqbalance.h"
+
+int dry_run = 0;
+
+/* the report of the last interval, served over the socket */
+static char *report;
+static size_t report_len;
+
+/* load of each cpu as measured, and once the proposed placement is in effect */
+static uint64_t measured_load[NR_CPUS];
+static uint64_t predicted_load[NR_CPUS];
+
+struct imbalance {
+	double sum;
+	double sum_sq;
+	int count;
+};
+
+static void report_line(const char *fmt, ...)
+{
+	va_list ap;
+	char *line, *newptr;
+	int len;
+
+	va_start(ap, fmt);
+	len = vasprintf(&line, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+
+	log(TO_CONSOLE, LOG_INFO, "%s", line);
+	newptr = realloc(report, report_len + len + 1);
+	if (newptr) {
+		report = newptr;
+		memcpy(report + report_len, line, len + 1);
+		report_len += len;
+	}
+	free(line);
+}
+
+static void read_affinity(struct irq_info *info, const char *file, cpumask_t *mask)
+{
+	char path[PATH_MAX];
+
+	sprintf(path, "/proc/irq/%i/%s", info->irq, file);
+	cpus_clear(*mask);
+	process_one_line(path, get_mask_from_bitmap, mask);
+}
+
+/* spread the load of an irq evenly over the online cpus of a mask */
+static void shift_load(struct irq_info *info, cpumask_t mask, int sign)
+{
+	uint64_t share;
+	int cpu;
+
+	cpus_and(mask, mask, cpu_online_map);
+	if (cpus_empty(mask))
+		return;
+
+	share = info->load / cpus_weight(mask);
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (!cpu_isset(cpu, mask))
+			continue;
+		if (sign > 0)
+			predicted_load[cpu] += share;
+		else
+			predicted_load[cpu] -= MIN(predicted_load[cpu], share);
+	}
+}
+
+static void init_cpu_load(struct topo_obj *cpu, void *data __attribute__((unused)))
+{
+	measured_load[cpu->number] = cpu->load;
+}
+
+/* placement charged the irqs it just moved to their new cpu, take that back */
+static void uncharge_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	struct topo_obj *cpu = info->assigned_obj;
+
+	if (!info->moved || !cpu || cpu->obj_type != OBJ_TYPE_CPU)
+		return;
+	measured_load[cpu->number] -= MIN(measured_load[cpu->number], info->load + 1);
+}
+
+static void diff_mapping(struct irq_info *info, void *data)
+{
+	int *changes = data;
+	char cur[PATH_MAX], proposed[PATH_MAX];
+	cpumask_t cur_mask, effective_mask, proposed_mask;
+
+	if (!info->assigned_obj)
+		return;
+
+	read_affinity(info, "smp_affinity", &cur_mask);
+	applied_affinity(info, &proposed_mask);
+
+	/* the cpus the irq actually fires on carry its load now */
+	read_affinity(info, "effective_affinity", &effective_mask);
+	if (cpus_empty(effective_mask))
+		effective_mask = cur_mask;
+	shift_load(info, effective_mask, -1);
+	shift_load(info, proposed_mask, 1);
+
+	/* the placement counts as done, as it would have been written */
+	info->moved = 0;
+
+	if (cpus_equal(cur_mask, proposed_mask))
+		return;
+
+	cpumask_scnprintf(cur, PATH_MAX, cur_mask);
+	cpumask_scnprintf(proposed, PATH_MAX, proposed_mask);
+	report_line("IRQ %d CURRENT %s PROPOSED %s OBJECT %d/%d LOAD %" PRIu64 "\n",
+		    info->irq, cur, proposed, info->assigned_obj->obj_type,
+		    info->assigned_obj->number, info->load);
+	(*changes)++;
+}
+
+static void add_object_load(struct topo_obj *d, void *data)
+{
+	uint64_t *load = data;
+
+	if (d->obj_type == OBJ_TYPE_CPU) {
+		load[0] += measured_load[d->number];
+		load[1] += predicted_load[d->number];
+	} else {
+		for_each_object(d->children, add_object_load, load);
+	}
+}
+
+static void report_object(struct topo_obj *d, void *data)
+{
+	uint64_t load[2] = { 0, 0 };
+
+	add_object_load(d, load);
+	report_line("TYPE %d NUMBER %d LOAD %" PRIu64 " PREDICTED %" PRIu64 "\n",
+		    d->obj_type, d->number, load[0], load[1]);
+	if (d->obj_type != OBJ_TYPE_CPU)
+		for_each_object(d->children, report_object, data);
+}
+
+static void add_cpu_load(struct imbalance *imb, struct topo_obj *cpu, uint64_t load)
+{
+	double l = capacity_load(cpu, load);
+
+	imb->sum += l;
+	imb->sum_sq += l * l;
+	imb->count++;
+}
+
+static void measure_imbalance(struct topo_obj *cpu, void *data)
+{
+	struct imbalance *imb = data;
+
+	/*
+	 * cpus set aside for heavy hitters are busy on purpose, parked ones
+	 * idle, and quarantined ones taken by a storm
+	 */
+	if (cpu_isset(cpu->number, dedicated_cpus) || cpu_isset(cpu->number, parked_cpus) ||
+	    cpu_isset(cpu->number, quarantined_cpus))
+		return;
+
+	add_cpu_load(&imb[0], cpu, measured_load[cpu->number]);
+	add_cpu_load(&imb[1], cpu, predicted_load[cpu->number]);
+}
+
+/* standard deviation of the capacity scaled cpu loads */
+static double imbalance_score(struct imbalance *imb)
+{
+	double mean, var;
+
+	if (!imb->count)
+		return 0;
+	mean = imb->sum / imb->count;
+	var = imb->sum_sq / imb->count - mean * mean;
+	return var > 0 ? sqrt(var) : 0;
+}
+
+/*
+ * Report the affinity each irq would get next to the one it has, the
+ * load every object would see afterwards, and how balanced the cpus
+ * are before and after.  Takes the place of activate_mappings.
+ */
+void report_mappings(void)
+{
+	struct imbalance imb[2];
+	int changes = 0;
+
+	free(report);
+	report = NULL;
+	report_len = 0;
+	memset(imb, 0, sizeof(imb));
+
+	for_each_object(cpus, init_cpu_load, NULL);
+	for_each_irq(NULL, uncharge_irq, NULL);
+	memcpy(predicted_load, measured_load, sizeof(predicted_load));
+	for_each_irq(NULL, diff_mapping, &changes);
+	for_each_object(numa_nodes, report_object, NULL);
+	for_each_object(cpus, measure_imbalance, imb);
+
+	report_line("CHANGES %d IMBALANCE %.4g PREDICTED %.4g\n", changes,
+		    imbalance_score(&imb[0]), imbalance_score(&imb[1]));
+}
+
+char *get_dry_run_report(void)
+{
+	return report ? g_strdup(report) : NULL;
+}
@@ -47,34 +47,31 @@
 
 volatile int keep_going = 1;
 int one_shot_mode;
-int debug_mode;
 int foreground_mode;
-int numa_avail;
-int journal_logging = 0;
-int need_rescan;
-int need_rebuild;
-unsigned int log_mask = TO_ALL;
-const char *log_indent;
-unsigned long power_thresh = ULONG_MAX;
-unsigned long deepest_cache = 2;
-unsigned long long cycle_count = 0;
 char *pidfile = NULL;
-char *polscript = NULL;
-long HZ;
-int sleep_interval = SLEEP_INTERVAL;
-int last_interval;
 GMainLoop *main_loop;
 
-char *cpu_ban_string = NULL;
-unsigned long migrate_ratio = 0;
-
 #ifdef HAVE_IRQBALANCEUI
 int socket_fd;
 char socket_name[108];
-char *banned_cpumask_from_ui = NULL;
 #endif
 
 #ifdef HAVE_GETOPT_LONG
+/* long only options */
+#define OPT_IRQTRACE	256
+#define OPT_PRESSURE	257
+#define OPT_SMTTHRESH	258
+#define OPT_APPLOAD	259
+#define OPT_NETQUEUE	260
+#define OPT_HINTPOLICY	261
+#define OPT_DEDICATE	262
+#define OPT_SOLVER	263
+#define OPT_DRYRUN	264
+#define OPT_CONSOLIDATE	265
+#define OPT_WAKELATENCY	266
+#define OPT_STORM	267
+#define OPT_QUARANTINE	268
+
 struct option lopts[] = {
 	{"oneshot", 0, NULL, 'o'},
 	{"debug", 0, NULL, 'd'},
@@ -89,6 +86,19 @@ struct option lopts[] = {
 	{"interval", 1 , NULL, 't'},
 	{"version", 0, NULL, 'V'},
 	{"migrateval", 1, NULL, 'e'},
+	{"irqtrace", 0, NULL, OPT_IRQTRACE},
+	{"pressure", 1, NULL, OPT_PRESSURE},
+	{"smtthresh", 1, NULL, OPT_SMTTHRESH},
+	{"appload", 1, NULL, OPT_APPLOAD},
+	{"netqueue", 1, NULL, OPT_NETQUEUE},
+	{"hintpolicy", 1, NULL, OPT_HINTPOLICY},
+	{"dedicate", 1, NULL, OPT_DEDICATE},
+	{"solver", 1, NULL, OPT_SOLVER},
+	{"dryrun", 0, NULL, OPT_DRYRUN},
+	{"consolidate", 1, NULL, OPT_CONSOLIDATE},
+	{"wakelatency", 1, NULL, OPT_WAKELATENCY},
+	{"storm", 1, NULL, OPT_STORM},
+	{"quarantine", 1, NULL, OPT_QUARANTINE},
 	{0, 0, 0, 0}
 };
 
@@ -97,6 +107,11 @@ static void usage(void)
 	log(TO_CONSOLE, LOG_INFO, "irqbalance [--oneshot | -o] [--debug | -d] [--foreground | -f] [--journal | -j]\n");
 	log(TO_CONSOLE, LOG_INFO, "	[--powerthresh= | -p <off> | <n>] [--banirq= | -i <n>] [--banmod= | -m <module>] [--policyscript= | -l <script>]\n");
 	log(TO_CONSOLE, LOG_INFO, "	[--pid= | -s <file>] [--deepestcache= | -c <n>] [--interval= | -t <n>] [--migrateval= | -e <n>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--irqtrace] [--pressure=<threshold>[,<window>]] [--smtthresh=<n>] [--appload=<percent>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--netqueue=<align | rewrite>] [--hintpolicy=<ignore | subset | exact>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--dedicate=<percent>] [--solver=<greedy | global>[,<ms>]]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--dryrun] [--consolidate=<cache | package>[,<percent>]] [--wakelatency=<us>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--storm=<irqs per second>] [--quarantine=<cpulist>]\n");
 }
 
 static void version(void)
@@ -188,6 +203,127 @@ static void parse_command_line(int argc, char **argv)
 					exit(1);
 				}
 				break;
+			case OPT_DRYRUN:
+				dry_run = 1;
+				break;
+			case OPT_IRQTRACE:
+				irqtrace_mode = 1;
+				break;
+			case OPT_SMTTHRESH:
+				smt_threshold = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_APPLOAD:
+				app_load_weight = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr || *endptr != '\0' || app_load_weight > 1000) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_NETQUEUE:
+				if (!strcmp(optarg, "align"))
+					netqueue_mode = NETQUEUE_ALIGN;
+				else if (!strcmp(optarg, "rewrite"))
+					netqueue_mode = NETQUEUE_REWRITE;
+				else {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_SOLVER:
+				if (g_str_has_prefix(optarg, "greedy")) {
+					solver_mode = SOLVER_GREEDY;
+					endptr = optarg + strlen("greedy");
+				} else if (g_str_has_prefix(optarg, "global")) {
+					solver_mode = SOLVER_GLOBAL;
+					endptr = optarg + strlen("global");
+				} else {
+					usage();
+					exit(1);
+				}
+				if (*endptr == ',')
+					solver_budget = strtoul(endptr + 1, &endptr, 10);
+				if (*endptr != '\0' || !solver_budget || solver_budget > 1000) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_CONSOLIDATE:
+				if (g_str_has_prefix(optarg, "cache")) {
+					consolidate_mode = CONSOLIDATE_CACHE;
+					endptr = optarg + strlen("cache");
+				} else if (g_str_has_prefix(optarg, "package")) {
+					consolidate_mode = CONSOLIDATE_PACKAGE;
+					endptr = optarg + strlen("package");
+				} else {
+					usage();
+					exit(1);
+				}
+				if (*endptr == ',')
+					consolidate_threshold = strtoul(endptr + 1, &endptr, 10);
+				if (*endptr != '\0' || !consolidate_threshold || consolidate_threshold > 100) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_WAKELATENCY:
+				wake_latency_threshold = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr || *endptr != '\0') {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_STORM:
+				storm_threshold = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr || *endptr != '\0') {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_QUARANTINE:
+				if (cpulist_parse(optarg, strlen(optarg), storm_cpus) ||
+				    cpus_empty(storm_cpus)) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_DEDICATE:
+				dedicate_threshold = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr || *endptr != '\0' || dedicate_threshold > 100) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_HINTPOLICY:
+				if (!strcmp(optarg, "ignore"))
+					hint_policy = HINT_POLICY_IGNORE;
+				else if (!strcmp(optarg, "subset"))
+					hint_policy = HINT_POLICY_SUBSET;
+				else if (!strcmp(optarg, "exact"))
+					hint_policy = HINT_POLICY_EXACT;
+				else {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_PRESSURE:
+				pressure_threshold = strtoul(optarg, &endptr, 10);
+				if (optarg == endptr) {
+					usage();
+					exit(1);
+				}
+				if (*endptr == ',')
+					pressure_window = strtoul(endptr + 1, &endptr, 10);
+				if (*endptr != '\0' || pressure_window < 500000 ||
+				    pressure_window > 10000000 ||
+				    pressure_threshold > pressure_window) {
+					usage();
+					exit(1);
+				}
+				break;
 		}
 	}
 }
@@ -245,17 +381,6 @@ static void dump_object_tree(void)
 	for_each_object(numa_nodes, dump_numa_node_info, NULL);
 }
 
-void force_rebalance_irq(struct irq_info *info, void *data __attribute__((unused)))
-{
-	if (info->level == BALANCE_NONE)
-		return;
-
-	if (info->assigned_obj == NULL)
-		rebalance_irq_list = g_list_append(rebalance_irq_list, info);
-	else
-		migrate_irq_obj(info->assigned_obj, NULL, info);
-}
-
 gboolean handler(gpointer data __attribute__((unused)))
 {
 	keep_going = 0;
@@ -299,33 +424,43 @@ gboolean scan(gpointer data __attribute__((unused)))
 
 		for_each_irq(NULL, force_rebalance_irq, NULL);
 		clear_slots();
+		/* the snapshot predates the new tree, sample procfs directly */
+		drop_snapshot();
 		parse_proc_interrupts();
 		parse_proc_stat();
 		return TRUE;
 	}
 
 	parse_proc_stat();
-
-	if (cycle_count)	
+	update_cpuidle();
+	update_colocation();
+	align_net_queues();
+	update_quarantine();
+	update_dedicated_cpus();
+	update_consolidation();
+
+	/* the solver weighs the current placement against every other */
+	if (cycle_count && solver_mode == SOLVER_GREEDY)
 		update_migration_status();
+	else if (solver_mode == SOLVER_GLOBAL)
+		solve_placement();
 
 	calculate_placement();
-	activate_mappings();
+	if (dry_run)
+		report_mappings();
+	else
+		activate_mappings();
+	steer_net_queues();
 
 out:
-	if (debug_mode)
+	if (debug_mode) {
 		dump_tree();
+		dump_cost_model();
+	}
 	if (one_shot_mode)
 		keep_going = 0;
 	cycle_count++;
 
-	/* sleep_interval may be changed by socket */
-	if (last_interval != sleep_interval) {
-		last_interval = sleep_interval;
-		g_timeout_add_seconds(sleep_interval, scan, NULL);
-		return FALSE;
-	}
-
 	if (keep_going) {
 		return TRUE;
 	}
@@ -354,9 +489,21 @@ void get_irq_data(struct irq_info *irq, void *data)
 			(irq->irq_count - irq->last_irq_count), irq->class);
 }
 
+/*
+ * The stats gathered so far, how deep in the tree the walk is, and whether
+ * the client asked for the depth with "stats depth"
+ */
+struct object_stat {
+	char **stats;
+	int depth;
+	int send_depth;
+};
+
 void get_object_stat(struct topo_obj *object, void *data)
 {
-	char **stats = (char **)data;	
+	struct object_stat *walk = data;
+	struct object_stat child = { walk->stats, walk->depth + 1, walk->send_depth };
+	char **stats = walk->stats;
 	char *irq_data = NULL;
 	char *newptr = NULL;
 	size_t irqdlen;
@@ -369,16 +516,16 @@ void get_object_stat(struct topo_obj *object, void *data)
 	/*
 	 * Note, the size in both conditional branches below is made up as follows:
 	 * strlen(irq_data) - self explanitory
-	 * 31 - The size of "TYPE  NUMBER  LOAD  SAVE_MODE  "
+	 * 38 - The size of "TYPE  NUMBER  LOAD  SAVE_MODE  DEPTH  "
 	 * 11 - The maximal size of a %d printout
 	 * 20 - The maximal size of a %lu printout
 	 * 1 - The trailing string terminator
 	 * This should be adjusted if the string in the sprintf is changed
 	 */
 	if (!*stats) {
-		newptr = calloc(irqdlen + 31 + 11 + 20 + 11 + 1, 1);
+		newptr = calloc(irqdlen + 38 + 11 + 20 + 11 + 11 + 1, 1);
 	} else {
-		newptr = realloc(*stats, strlen(*stats) + irqdlen + 31 + 11 + 20 + 11 + 1);
+		newptr = realloc(*stats, strlen(*stats) + irqdlen + 38 + 11 + 20 + 11 + 11 + 1);
 	}
 
 	if (!newptr) {
@@ -388,12 +535,16 @@ void get_object_stat(struct topo_obj *object, void *data)
 
 	*stats = newptr;
 
-	sprintf(*stats + strlen(*stats), "TYPE %d NUMBER %d LOAD %" PRIu64 " SAVE_MODE %d %s",
+	sprintf(*stats + strlen(*stats), "TYPE %d NUMBER %d LOAD %" PRIu64 " SAVE_MODE %d ",
 			object->obj_type, object->number, object->load,
-			object->powersave_mode, irq_data ? irq_data : "");
+			object->powersave_mode);
+	/* nested cache domains share a type, the depth tells where each belongs */
+	if (walk->send_depth)
+		sprintf(*stats + strlen(*stats), "DEPTH %d ", walk->depth);
+	strcat(*stats, irq_data ? irq_data : "");
 	free(irq_data);
 	if (object->obj_type != OBJ_TYPE_CPU) {
-		for_each_object(object->children, get_object_stat, data);
+		for_each_object(object->children, get_object_stat, &child);
 	}
 }
 
@@ -449,7 +600,10 @@ gboolean sock_handle(gint fd, GIOCondition condition, gpointer user_data __attri
 
 		if (g_str_has_prefix(buff, "stats")) {
 			char *stats = NULL;
-			for_each_object(numa_nodes, get_object_stat, &stats);
+			struct object_stat walk = { &stats, 0,
+				g_str_has_prefix(buff, "stats depth") };
+
+			for_each_object(numa_nodes, get_object_stat, &walk);
 			send(sock, stats, strlen(stats), 0);
 			free(stats);
 		}
@@ -465,7 +619,8 @@ gboolean sock_handle(gint fd, GIOCondition condition, gpointer user_data __attri
 				sleep_string[recv_size - strlen("settings sleep ")] = '\0';
 				int new_iterval = strtoul(sleep_string, NULL, 10);
 				if (new_iterval >= 1) {
-					sleep_interval = new_iterval;
+					/* picked up by the collector on its next wakeup */
+					g_atomic_int_set(&sleep_interval, new_iterval);
 				}
 				free(sleep_string);
 			} else if (g_str_has_prefix(buff + strlen("settings "), "ban irqs ")) {
@@ -512,6 +667,27 @@ gboolean sock_handle(gint fd, GIOCondition condition, gpointer user_data __attri
 				need_rescan = 1;
 			}
 		}
+		if (g_str_has_prefix(buff, "pressure")) {
+			char *pressure = get_pressure_stat();
+
+			if (pressure)
+				send(sock, pressure, strlen(pressure), 0);
+			g_free(pressure);
+		}
+		if (g_str_has_prefix(buff, "storms")) {
+			char *storms = get_storm_stat();
+
+			if (storms)
+				send(sock, storms, strlen(storms), 0);
+			g_free(storms);
+		}
+		if (g_str_has_prefix(buff, "dryrun")) {
+			char *dry_run_report = get_dry_run_report();
+
+			if (dry_run_report)
+				send(sock, dry_run_report, strlen(dry_run_report), 0);
+			g_free(dry_run_report);
+		}
 		if (g_str_has_prefix(buff, "setup")) {
 			char banned[512];
 			char *setup = calloc(strlen("SLEEP  ") + 11 + 1, 1);
@@ -668,6 +844,10 @@ int main(int argc, char** argv)
 		}
 	}
 
+	/* cpus in isolated cpuset partitions are banned from the start */
+	if (init_cgroup_watch())
+		log(TO_ALL, LOG_WARNING, "Failed to watch cpuset partitions.\n");
+
 	build_object_tree();
 	if (debug_mode)
 		dump_object_tree();
@@ -690,6 +870,17 @@ int main(int argc, char** argv)
 	g_unix_signal_add(SIGHUP, force_rescan, NULL);
 	sigprocmask(SIG_SETMASK, &old_sigset, NULL);
 
+	/* Opening the tracepoints needs privileges, so do it before dropping them */
+	if (irqtrace_mode && init_irqtrace()) {
+		log(TO_ALL, LOG_WARNING, "Failed to initialize irq tracing, estimating irq load instead.\n");
+		irqtrace_mode = 0;
+	}
+	/* The frequency counters need CAP_SYS_RAWIO */
+	init_cpufreq();
+	/* Windows that aren't a multiple of 2s need CAP_SYS_RESOURCE, too */
+	if (init_pressure())
+		log(TO_ALL, LOG_WARNING, "Failed to initialize irq pressure trigger.\n");
+
 #ifdef HAVE_LIBCAP_NG
 	// Drop capabilities
 	capng_clear(CAPNG_SELECT_BOTH);
@@ -712,14 +903,21 @@ int main(int argc, char** argv)
 	if (init_thermal())
 		log(TO_ALL, LOG_WARNING, "Failed to initialize thermal events.\n");
 	main_loop = g_main_loop_new(NULL, FALSE);
-	last_interval = sleep_interval;
-	g_timeout_add_seconds(sleep_interval, scan, NULL);
+	if (init_collector(scan)) {
+		ret = EXIT_FAILURE;
+		goto out;
+	}
 	g_main_loop_run(main_loop);
 
 	g_main_loop_quit(main_loop);
 
 out:
+	deinit_cgroup_watch();
+	deinit_pressure();
+	deinit_collector();
+	deinit_irqtrace();
 	deinit_thermal();
+	deinit_cpufreq();
 	free_object_tree();
 	free_cl_opts();
 	free(polscript);
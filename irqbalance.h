@@ -7,6 +7,7 @@
 #include "cpumask.h"
 
 #include <stdint.h>
+#include <stdio.h>
 #include <glib.h>
 #include <glib-unix.h>
 #include <syslog.h>
@@ -30,6 +31,8 @@
 #endif
 
 #define	NUMA_NO_NODE (-1)
+#define	NUMA_LOCAL_DISTANCE 10
+#define	NUMA_REMOTE_DISTANCE 20
 
 extern char *classes[];
 
@@ -38,11 +41,16 @@ extern void clear_work_stats(void);
 extern void parse_proc_interrupts(void);
 extern GList* collect_full_irq_list(void);
 extern void parse_proc_stat(void);
+extern uint64_t stat_interval;
+extern int steal_reported;
+struct irqtrace_sample;
+extern void distribute_load(struct irqtrace_sample *trace);
 extern void set_interrupt_count(int number, uint64_t count);
 extern void set_msi_interrupt_numa(int number);
 extern void init_irq_class_and_type(char *savedline, struct irq_info *info, int irq);
 extern int proc_irq_hotplug(char *line, int irq, struct irq_info **pinfo);
 extern void clear_no_existing_irqs(void);
+extern gboolean scan(gpointer data);
 
 extern GList *rebalance_irq_list;
 extern void force_rebalance_irq(struct irq_info *info, void *data __attribute__((unused)));
@@ -51,10 +59,12 @@ void update_migration_status(void);
 void dump_workloads(void);
 void sort_irq_list(GList **list);
 void calculate_placement(void);
+int irq_shuns_obj(struct irq_info *info, struct topo_obj *d);
 void dump_tree(void);
 void migrate_irq_obj(struct topo_obj *from, struct topo_obj *to, struct irq_info *info);
 
 void activate_mappings(void);
+void applied_affinity(struct irq_info *info, cpumask_t *mask);
 void clear_cpu_tree(void);
 void free_cpu_topo(gpointer data);
 /*===================NEW BALANCER FUNCTIONS============================*/
@@ -80,8 +90,14 @@ extern unsigned long deepest_cache;
 extern char *polscript;
 extern cpumask_t banned_cpus;
 extern cpumask_t unbanned_cpus;
+extern char *cpu_ban_string;
+extern char *banned_cpumask_from_ui;
 extern long HZ;
 extern unsigned long migrate_ratio;
+extern unsigned long smt_threshold;
+extern unsigned long app_load_weight;
+extern int hint_policy;
+extern int sleep_interval;
 
 /*
  * Numa node access routines
@@ -91,6 +107,37 @@ extern void free_numa_node_list(void);
 extern void dump_numa_node_info(struct topo_obj *node, void *data);
 extern void connect_cpu_mem_topo(struct topo_obj *p, void *data);
 extern struct topo_obj *get_numa_node(int nodeid);
+extern int numa_node_distance(int from, int to);
+extern void add_numa_node(int nodeid, cpumask_t mask);
+extern void reset_numa_node_distances(void);
+extern void set_numa_node_distance(int from, int to, int distance);
+
+/*
+ * A set of cpus sharing something below the package: a die, a cache or a
+ * cluster.  Each distinct one becomes a level of the tree between the
+ * package and the cpu.
+ */
+struct cpu_domain {
+	cpumask_t mask;
+	int level;
+	int cache_level;
+};
+
+/* die, cluster, physical core and one per cache index */
+#define MAX_CPU_DOMAINS	16
+
+/* where a cpu sits in the topology */
+struct cpu_desc {
+	int number;
+	int package;
+	int node;
+	unsigned int capacity;
+	cpumask_t package_mask;
+	int nr_domains;
+	struct cpu_domain domains[MAX_CPU_DOMAINS];
+};
+extern void add_cpu_to_tree(struct cpu_desc *desc);
+extern void finish_cpu_tree(void);
 
 /*
  * cpu core functions
@@ -98,12 +145,133 @@ extern struct topo_obj *get_numa_node(int nodeid);
 #define cpu_numa_node(cpu) ((cpu)->parent->numa_nodes)
 extern struct topo_obj *find_cpu_core(int cpunr);
 extern int get_cpu_count(void);
+extern void for_each_domain_tier(void (*cb)(GList *tier, void *data), void *data);
+extern void update_isolated_cpus(cpumask_t isolated);
+
+/*
+ * cpu capacity, CAPACITY_SCALE is the fastest cpu at full speed
+ */
+#define CAPACITY_SCALE	1024
+extern void update_cpu_capacity(int cpunr);
+extern void update_capacity(void);
+
+/* load an object is judged by, its irq time plus weighted application time */
+static inline uint64_t obj_cost(struct topo_obj *d)
+{
+	if (!app_load_weight)
+		return d->load;
+	return d->load + d->app_load * app_load_weight / 100;
+}
+
+/* load of an object as if all its cpus ran at full capacity */
+static inline uint64_t capacity_load(struct topo_obj *d, uint64_t load)
+{
+	if (!d->capacity || d->capacity == CAPACITY_SCALE)
+		return load;
+	return load * CAPACITY_SCALE / d->capacity;
+}
+
+/*
+ * dedicated core functions
+ */
+extern unsigned long dedicate_threshold;
+extern cpumask_t dedicated_cpus;
+extern void update_dedicated_cpus(void);
+
+/* the object only has cpus set aside for heavy hitters */
+static inline int obj_is_dedicated(struct topo_obj *d)
+{
+	return !cpus_empty(dedicated_cpus) && cpus_subset(d->mask, dedicated_cpus);
+}
+
+/*
+ * storm quarantine functions
+ */
+extern unsigned long storm_threshold;
+extern cpumask_t storm_cpus;
+extern cpumask_t quarantined_cpus;
+extern void update_quarantine(void);
+extern char *get_storm_stat(void);
+
+/* the object only has cpus storming irqs are confined to */
+static inline int obj_is_quarantined(struct topo_obj *d)
+{
+	return !cpus_empty(quarantined_cpus) && cpus_subset(d->mask, quarantined_cpus);
+}
+
+/*
+ * consolidation functions
+ */
+#define CONSOLIDATE_OFF		0
+#define CONSOLIDATE_CACHE	1
+#define CONSOLIDATE_PACKAGE	2
+extern int consolidate_mode;
+extern unsigned long consolidate_threshold;
+extern cpumask_t parked_cpus;
+extern void update_consolidation(void);
+
+/* the object only has cpus of parked domains */
+static inline int obj_is_parked(struct topo_obj *d)
+{
+	return !cpus_empty(parked_cpus) && cpus_subset(d->mask, parked_cpus);
+}
+
+/*
+ * idle state functions
+ */
+extern unsigned long wake_latency_threshold;
+extern void update_cpuidle(void);
+extern void average_cpuidle(void);
+
+static inline int irq_is_latency_sensitive(struct irq_info *info)
+{
+	return wake_latency_threshold && (info->flags & IRQ_FLAG_LATENCY);
+}
+
+/* interrupts to the object have to wait for its cpus to wake up */
+static inline int obj_is_asleep(struct topo_obj *d)
+{
+	return d->wake_latency > wake_latency_threshold;
+}
+
+/*
+ * cpu frequency functions
+ */
+extern void update_cpufreq(void);
+extern void init_cpufreq(void);
+extern void deinit_cpufreq(void);
+
+/* turn ns a cpu was busy into work at its top frequency */
+static inline uint64_t freq_work(struct topo_obj *cpu, uint64_t time)
+{
+	if (!cpu->freq_scale || cpu->freq_scale == CAPACITY_SCALE)
+		return time;
+	return time * cpu->freq_scale / CAPACITY_SCALE;
+}
+
 extern void clear_slots(void);
 
+/*
+ * global placement solver functions
+ */
+#define SOLVER_GREEDY	0
+#define SOLVER_GLOBAL	1
+extern int solver_mode;
+extern unsigned long solver_budget;
+extern void solve_placement(void);
+
+/*
+ * dry run functions
+ */
+extern int dry_run;
+extern void report_mappings(void);
+extern char *get_dry_run_report(void);
+
 /*
  * irq db functions
  */
 extern void rebuild_irq_db(void);
+extern struct irq_info *add_irq_to_db(int irq, int class, int numa_node);
 extern void free_irq_db(void);
 extern void add_cl_banned_irq(int irq);
 extern void for_each_irq(GList *list, void (*cb)(struct irq_info *info,  void *data), void *data);
@@ -114,6 +282,101 @@ extern void add_cl_banned_module(char *modname);
 #define irq_numa_node(irq) ((irq)->numa_node)
 
 
+/*
+ * interrupt cost model functions
+ */
+extern void update_cost_model(void);
+extern uint64_t irq_cost_weight(struct irq_info *info);
+extern void dump_cost_model(void);
+
+/*
+ * procfs collector functions
+ */
+enum proc_source {
+	PROC_INTERRUPTS,
+	PROC_STAT,
+	PROC_SOFTIRQS,
+	PROC_SOURCE_MAX
+};
+
+extern gboolean init_collector(GSourceFunc cb);
+extern void deinit_collector(void);
+extern void kick_collector(void);
+extern void drop_snapshot(void);
+extern FILE *open_proc_source(enum proc_source src);
+extern struct irqtrace_sample *snapshot_irqtrace(void);
+extern int read_sampled_line(char *path, void (*cb)(char *line, void *data), void *data);
+
+/*
+ * irq tracepoint functions
+ */
+struct irqtrace_sample {
+	uint64_t *irq_time;		/* ns spent in each irq's handler */
+	int nr_irqs;
+	uint64_t *cpu_irq_time;		/* ns of hardirq time per cpu */
+	uint64_t *cpu_softirq_time;	/* ns per cpu and softirq group */
+	int nr_cpus;
+	cpumask_t cpus;			/* cpus traced, the others keep the procfs estimate */
+};
+
+struct pollfd;
+extern int irqtrace_mode;
+extern gboolean init_irqtrace(void);
+extern void deinit_irqtrace(void);
+extern int irqtrace_nr_pollfds(void);
+extern int irqtrace_pollfds(struct pollfd *pfds);
+extern void irqtrace_drain(void);
+extern struct irqtrace_sample *irqtrace_collect(void);
+extern void free_irqtrace_sample(struct irqtrace_sample *s);
+
+/*
+ * irq pressure functions
+ */
+extern unsigned long pressure_threshold;
+extern unsigned long pressure_window;
+extern gboolean init_pressure(void);
+extern void deinit_pressure(void);
+extern char *get_pressure_stat(void);
+
+/*
+ * cgroup watcher functions
+ */
+extern cpumask_t cgroup_isolated_cpus;
+extern gboolean init_cgroup_watch(void);
+extern void deinit_cgroup_watch(void);
+extern void update_colocation(void);
+extern void colocate_irq(struct irq_info *info, cpumask_t *cgroup_cpus);
+
+/*
+ * network queue functions
+ */
+#define NETQUEUE_OFF	0
+#define NETQUEUE_ALIGN	1
+#define NETQUEUE_REWRITE	2
+extern int netqueue_mode;
+extern void map_net_queues(void);
+extern void align_net_queues(void);
+extern void steer_net_queues(void);
+
+/*
+ * the object has cpus outside the cgroup the irq is co-located with, or
+ * outside the affinity hint it is balanced within
+ */
+static inline int outside_colocation(struct irq_info *info, struct topo_obj *d)
+{
+	if (!cpus_empty(info->colocate_mask) && !cpus_subset(d->mask, info->colocate_mask))
+		return 1;
+	return info->hint_policy == HINT_POLICY_SUBSET && !cpus_subset(d->mask, info->affinity_hint);
+}
+
+/* none of the object's cpus is one the irq may be placed on */
+static inline int misses_colocation(struct irq_info *info, struct topo_obj *d)
+{
+	if (!cpus_empty(info->colocate_mask) && !cpus_intersects(d->mask, info->colocate_mask))
+		return 1;
+	return info->hint_policy == HINT_POLICY_SUBSET && !cpus_intersects(d->mask, info->affinity_hint);
+}
+
 /*
  * Generic object functions
  */
@@ -170,6 +433,7 @@ extern unsigned int log_mask;
 
 extern int process_one_line(char *path, void (*cb)(char *line, void *data), void *data);
 extern void get_mask_from_bitmap(char *line, void *mask);
+extern void get_mask_from_cpulist(char *line, void *mask);
 extern void get_int(char *line, void *data);
 extern void get_hex(char *line, void *data);
 
@@ -35,12 +35,16 @@
 #include "types.h"
 #include "irqbalance.h"
 
+unsigned long power_thresh = ULONG_MAX;
+unsigned long migrate_ratio = 0;
+unsigned long long cycle_count = 0;
 
 
 struct load_balance_info {
 	unsigned long long int total_load;
 	unsigned long long avg_load;
 	unsigned long long min_load;
+	struct topo_obj *min_obj;	/* the object with the min_load */
 	unsigned long long adjustment_load;
 	int load_sources;
 	unsigned long long int deviations;
@@ -54,10 +58,20 @@ struct load_balance_info {
 static void gather_load_stats(struct topo_obj *obj, void *data)
 {
 	struct load_balance_info *info = data;
+	uint64_t load = capacity_load(obj, obj_cost(obj));
 
-	if (info->load_sources == 0 || obj->load < info->min_load)
-		info->min_load = obj->load;
-	info->total_load += obj->load;
+	/*
+	 * a heavy hitter's cpu is busy by design, a parked one idle, and a
+	 * quarantined one drowning in a storm, leave them out of the stats
+	 */
+	if (obj_is_dedicated(obj) || obj_is_parked(obj) || obj_is_quarantined(obj))
+		return;
+
+	if (info->load_sources == 0 || load < info->min_load) {
+		info->min_load = load;
+		info->min_obj = obj;
+	}
+	info->total_load += load;
 	info->load_sources += 1;
 }
 
@@ -65,10 +79,14 @@ static void compute_deviations(struct topo_obj *obj, void *data)
 {
 	struct load_balance_info *info = data;
 	unsigned long long int deviation;
+	uint64_t load = capacity_load(obj, obj_cost(obj));
+
+	if (obj_is_dedicated(obj) || obj_is_parked(obj) || obj_is_quarantined(obj))
+		return;
 
-	deviation = (obj->load > info->avg_load) ?
-		obj->load - info->avg_load :
-		info->avg_load - obj->load;
+	deviation = (load > info->avg_load) ?
+		load - info->avg_load :
+		info->avg_load - load;
 
 	info->deviations += (deviation * deviation);
 }
@@ -77,11 +95,16 @@ static void move_candidate_irqs(struct irq_info *info, void *data)
 {
 	struct load_balance_info *lb_info = data;
 	unsigned long delta_load = 0;
+	uint64_t load;
 
 	/* Don't rebalance irqs that don't want or support it */
 	if (info->level == BALANCE_NONE)
 		return;
 
+	/* heavy hitters stay on their own cpu, storms in quarantine */
+	if (info->flags & (IRQ_FLAG_DEDICATED | IRQ_FLAG_STORM))
+		return;
+
 	/* Don't move cpus that only have one irq, regardless of load */
 	if (g_list_length(info->assigned_obj->interrupts) <= 1)
 		return;
@@ -92,14 +115,21 @@ static void move_candidate_irqs(struct irq_info *info, void *data)
 	if (info->load <= 1)
 		return;
 
+	/* leave those to others that can actually go to the least loaded object */
+	if (lb_info->min_obj && irq_shuns_obj(info, lb_info->min_obj))
+		return;
+
+	/* compare in the same capacity scaled units as the object loads */
+	load = capacity_load(info->assigned_obj, info->load);
+
 	if (migrate_ratio > 0) {
 		delta_load = (lb_info->adjustment_load - lb_info->min_load) / migrate_ratio;
 	}
 
 	/* If we can migrate an irq without swapping the imbalance do it. */
-	if ((lb_info->min_load + info->load) < delta_load + (lb_info->adjustment_load - info->load)) {
-		lb_info->adjustment_load -= info->load;
-		lb_info->min_load += info->load;
+	if ((lb_info->min_load + load) < delta_load + (lb_info->adjustment_load - load)) {
+		lb_info->adjustment_load -= load;
+		lb_info->min_load += load;
 		if (lb_info->min_load > lb_info->adjustment_load) {
 			lb_info->min_load = lb_info->adjustment_load;
 		}
@@ -114,20 +144,24 @@ static void move_candidate_irqs(struct irq_info *info, void *data)
 static void migrate_overloaded_irqs(struct topo_obj *obj, void *data)
 {
 	struct load_balance_info *info = data;
+	uint64_t load = capacity_load(obj, obj_cost(obj));
+
+	if (obj_is_dedicated(obj) || obj_is_parked(obj) || obj_is_quarantined(obj))
+		return;
 
 	if (obj->powersave_mode)
 		info->num_powersave++;
 
-	if ((obj->load + info->std_deviation) <= info->avg_load) {
+	if ((load + info->std_deviation) <= info->avg_load) {
 		info->num_under++;
 		if (power_thresh != ULONG_MAX && !info->powersave)
 			if (!obj->powersave_mode)
 				info->powersave = obj;
-	} else if ((obj->load - info->std_deviation) >=info->avg_load) {
+	} else if ((load - info->std_deviation) >=info->avg_load) {
 		info->num_over++;
 	}
 
-	if ((obj->load > info->min_load) &&
+	if ((load > info->min_load) &&
 	    (g_list_length(obj->interrupts) > 1)) {
 		/* order the list from greatest to least workload */
 		sort_irq_list(&obj->interrupts);
@@ -139,7 +173,7 @@ static void migrate_overloaded_irqs(struct topo_obj *obj, void *data)
 		 * without reversing the imbalance or until we only have one
 		 * left.
 		 */
-		info->adjustment_load = obj->load;
+		info->adjustment_load = load;
 		for_each_irq(obj->interrupts, move_candidate_irqs, info);
 	}
 }
@@ -166,6 +200,11 @@ static void find_overloaded_objs(GList *name, struct load_balance_info *info) {
 	for_each_object(name, migrate_overloaded_irqs, info);
 }
 
+static void find_overloaded_tier(GList *tier, void *data)
+{
+	find_overloaded_objs(tier, data);
+}
+
 void update_migration_status(void)
 {
 	struct load_balance_info info;
@@ -181,7 +220,7 @@ void update_migration_status(void)
 			for_each_object(cpus, clear_powersave_mode, NULL);
 		}
 	}
-	find_overloaded_objs(cache_domains, &info);
+	for_each_domain_tier(find_overloaded_tier, &info);
 	find_overloaded_objs(packages, &info);
 	find_overloaded_objs(numa_nodes, &info);
 }
@@ -230,3 +269,14 @@ void migrate_irq_obj(struct topo_obj *from, struct topo_obj *to, struct irq_info
 
 	info->assigned_obj = to;
 }
+
+void force_rebalance_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	if (info->level == BALANCE_NONE)
+		return;
+
+	if (info->assigned_obj == NULL)
+		rebalance_irq_list = g_list_append(rebalance_irq_list, info);
+	else
+		migrate_irq_obj(info->assigned_obj, NULL, info);
+}
@@ -0,0 +1,490 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the optional irq tracepoint collector.  It records the
+ * irq and softirq entry/exit tracepoints of every cpu into a per cpu perf
+ * ring buffer and pairs them up to measure how many nanoseconds each irq
+ * handler and each softirq group actually ran, instead of estimating it
+ * from jiffies and interrupt counts.  The rings are drained by the
+ * collector thread only.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "irqbalance.h"
+
+#define RING_PAGES	64	/* data pages per cpu, must be a power of 2 */
+
+int irqtrace_mode = 0;
+
+enum trace_event {
+	EV_IRQ_ENTRY,
+	EV_IRQ_EXIT,
+	EV_SOFTIRQ_ENTRY,
+	EV_SOFTIRQ_EXIT,
+	EV_MAX
+};
+
+static struct trace_event_desc {
+	const char *name;
+	const char *field;
+	int id;
+	int offset;
+} events[EV_MAX] = {
+	[EV_IRQ_ENTRY]		= { "irq_handler_entry", "irq", -1, -1 },
+	[EV_IRQ_EXIT]		= { "irq_handler_exit", "irq", -1, -1 },
+	[EV_SOFTIRQ_ENTRY]	= { "softirq_entry", "vec", -1, -1 },
+	[EV_SOFTIRQ_EXIT]	= { "softirq_exit", "vec", -1, -1 },
+};
+
+/* softirq vector numbers, see include/linux/interrupt.h */
+static int map_vec_to_group[] = {
+	SOFTIRQ_OTHER,	/* HI */
+	SOFTIRQ_OTHER,	/* TIMER */
+	SOFTIRQ_NET,	/* NET_TX */
+	SOFTIRQ_NET,	/* NET_RX */
+	SOFTIRQ_BLOCK,	/* BLOCK */
+	SOFTIRQ_BLOCK,	/* IRQ_POLL */
+	SOFTIRQ_OTHER,	/* TASKLET */
+	SOFTIRQ_OTHER,	/* SCHED */
+	SOFTIRQ_OTHER,	/* HRTIMER */
+	SOFTIRQ_OTHER,	/* RCU */
+};
+
+struct trace_ring {
+	int cpu;
+	int fds[EV_MAX];
+	void *base;
+	/* handler in progress on this cpu */
+	int irq;
+	uint64_t irq_start;
+	int vec;
+	uint64_t softirq_start;
+	uint64_t softirq_nested;
+};
+
+static struct trace_ring *rings;
+static int nr_rings;
+static size_t page_size;
+static unsigned long lost_samples;
+
+/* Running totals since the last sample, owned by the collector thread */
+static struct irqtrace_sample *totals;
+
+/* cpus with a ring, fixed once tracing started */
+static cpumask_t traced_cpus;
+
+static const char *tracefs_dirs[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+	NULL
+};
+
+/*
+ * Read the tracepoint id and the offset of the field we pair entry and exit
+ * events on from the event's format description.
+ */
+static int read_event_format(const char *tracefs, struct trace_event_desc *ev)
+{
+	char path[PATH_MAX];
+	char needle[64];
+	FILE *file;
+	char *line = NULL;
+	size_t size = 0;
+	char *c;
+
+	snprintf(path, PATH_MAX, "%s/events/irq/%s/id", tracefs, ev->name);
+	if (process_one_line(path, get_int, &ev->id) < 0)
+		return -1;
+
+	snprintf(path, PATH_MAX, "%s/events/irq/%s/format", tracefs, ev->name);
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	snprintf(needle, sizeof(needle), " %s;", ev->field);
+	while (getline(&line, &size, file) > 0) {
+		if (!strstr(line, needle))
+			continue;
+		c = strstr(line, "offset:");
+		if (c)
+			ev->offset = strtoul(c + strlen("offset:"), NULL, 10);
+		break;
+	}
+	free(line);
+	fclose(file);
+
+	return (ev->offset < 0) ? -1 : 0;
+}
+
+static int open_event(struct trace_event_desc *ev, int cpu)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.config = ev->id;
+	attr.sample_period = 1;
+	attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+	attr.watermark = 1;
+	attr.wakeup_watermark = RING_PAGES * page_size / 2;
+
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_ring(struct trace_ring *ring)
+{
+	int i;
+
+	if (ring->base)
+		munmap(ring->base, (RING_PAGES + 1) * page_size);
+	for (i = 0; i < EV_MAX; i++)
+		if (ring->fds[i] >= 0)
+			close(ring->fds[i]);
+}
+
+/*
+ * Open all four events on one cpu and direct them into a single ring, so
+ * the records of a cpu arrive in the order they happened.
+ */
+static int open_ring(struct trace_ring *ring, int cpu)
+{
+	int i;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->cpu = cpu;
+	ring->irq = -1;
+	ring->vec = -1;
+	for (i = 0; i < EV_MAX; i++)
+		ring->fds[i] = -1;
+
+	ring->fds[0] = open_event(&events[0], cpu);
+	if (ring->fds[0] < 0)
+		goto err;
+
+	ring->base = mmap(NULL, (RING_PAGES + 1) * page_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, ring->fds[0], 0);
+	if (ring->base == MAP_FAILED) {
+		ring->base = NULL;
+		goto err;
+	}
+
+	/* the ring has to exist before other events can be redirected to it */
+	for (i = 1; i < EV_MAX; i++) {
+		ring->fds[i] = open_event(&events[i], cpu);
+		if (ring->fds[i] < 0)
+			goto err;
+		if (ioctl(ring->fds[i], PERF_EVENT_IOC_SET_OUTPUT, ring->fds[0]))
+			goto err;
+	}
+
+	return 0;
+err:
+	close_ring(ring);
+	return -1;
+}
+
+static struct irqtrace_sample *alloc_irqtrace_sample(int nr_cpus)
+{
+	struct irqtrace_sample *s;
+
+	s = calloc(1, sizeof(struct irqtrace_sample));
+	if (!s)
+		return NULL;
+
+	s->nr_cpus = nr_cpus;
+	cpus_copy(s->cpus, traced_cpus);
+	s->cpu_irq_time = calloc(nr_cpus, sizeof(uint64_t));
+	s->cpu_softirq_time = calloc(nr_cpus * SOFTIRQ_GROUPS, sizeof(uint64_t));
+	if (!s->cpu_irq_time || !s->cpu_softirq_time) {
+		free_irqtrace_sample(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+void free_irqtrace_sample(struct irqtrace_sample *s)
+{
+	if (!s)
+		return;
+	free(s->irq_time);
+	free(s->cpu_irq_time);
+	free(s->cpu_softirq_time);
+	free(s);
+}
+
+static void account_irq_time(int irq, int cpu, uint64_t delta)
+{
+	if (irq >= totals->nr_irqs) {
+		int nr = MAX(irq + 1, totals->nr_irqs * 2);
+		uint64_t *irq_time = realloc(totals->irq_time, nr * sizeof(uint64_t));
+
+		if (!irq_time)
+			return;
+		memset(irq_time + totals->nr_irqs, 0,
+		       (nr - totals->nr_irqs) * sizeof(uint64_t));
+		totals->irq_time = irq_time;
+		totals->nr_irqs = nr;
+	}
+
+	totals->irq_time[irq] += delta;
+	totals->cpu_irq_time[cpu] += delta;
+}
+
+static void handle_sample(struct trace_ring *ring, uint64_t time, unsigned char *raw, uint32_t size)
+{
+	uint16_t type;
+	int i, val;
+
+	if (size < sizeof(type))
+		return;
+	memcpy(&type, raw, sizeof(type));
+
+	for (i = 0; i < EV_MAX; i++)
+		if (events[i].id == type)
+			break;
+	if (i == EV_MAX || (uint32_t)events[i].offset + sizeof(val) > size)
+		return;
+	memcpy(&val, raw + events[i].offset, sizeof(val));
+
+	switch (i) {
+	case EV_IRQ_ENTRY:
+		ring->irq = val;
+		ring->irq_start = time;
+		break;
+	case EV_IRQ_EXIT:
+		if (ring->irq != val || time < ring->irq_start)
+			break;
+		account_irq_time(val, ring->cpu, time - ring->irq_start);
+		/* hardirqs interrupting a softirq aren't softirq time */
+		if (ring->vec >= 0)
+			ring->softirq_nested += time - ring->irq_start;
+		ring->irq = -1;
+		break;
+	case EV_SOFTIRQ_ENTRY:
+		ring->vec = val;
+		ring->softirq_start = time;
+		ring->softirq_nested = 0;
+		break;
+	case EV_SOFTIRQ_EXIT:
+		if (ring->vec != val || time < ring->softirq_start + ring->softirq_nested)
+			break;
+		if ((unsigned int)val < G_N_ELEMENTS(map_vec_to_group))
+			totals->cpu_softirq_time[ring->cpu * SOFTIRQ_GROUPS + map_vec_to_group[val]] +=
+				time - ring->softirq_start - ring->softirq_nested;
+		ring->vec = -1;
+		break;
+	}
+}
+
+static void drain_ring(struct trace_ring *ring)
+{
+	struct perf_event_mmap_page *pg = ring->base;
+	unsigned char *data = (unsigned char *)ring->base + page_size;
+	uint64_t mask = RING_PAGES * page_size - 1;
+	unsigned char record[512];
+	uint64_t head, tail;
+
+	head = __atomic_load_n(&pg->data_head, __ATOMIC_ACQUIRE);
+	tail = pg->data_tail;
+
+	while (tail < head) {
+		struct perf_event_header *hdr = (void *)(data + (tail & mask));
+		uint64_t off = tail & mask;
+		size_t len = hdr->size;
+
+		if (!len)
+			break;
+
+		/* records may wrap around the end of the ring */
+		if (len <= sizeof(record)) {
+			if (off + len > mask + 1) {
+				memcpy(record, data + off, mask + 1 - off);
+				memcpy(record + mask + 1 - off, data, len - (mask + 1 - off));
+			} else {
+				memcpy(record, data + off, len);
+			}
+			hdr = (void *)record;
+
+			if (hdr->type == PERF_RECORD_SAMPLE &&
+			    len >= sizeof(*hdr) + sizeof(uint64_t) + sizeof(uint32_t)) {
+				uint64_t time;
+				uint32_t size;
+
+				memcpy(&time, record + sizeof(*hdr), sizeof(time));
+				memcpy(&size, record + sizeof(*hdr) + sizeof(time), sizeof(size));
+				if (sizeof(*hdr) + sizeof(time) + sizeof(size) + size <= len)
+					handle_sample(ring, time, record + sizeof(*hdr) +
+						      sizeof(time) + sizeof(size), size);
+			} else if (hdr->type == PERF_RECORD_LOST) {
+				uint64_t lost;
+
+				memcpy(&lost, record + sizeof(*hdr) + sizeof(uint64_t), sizeof(lost));
+				lost_samples += lost;
+				/* pairing is unreliable across the gap */
+				ring->irq = -1;
+				ring->vec = -1;
+			}
+		}
+
+		tail += len;
+	}
+
+	__atomic_store_n(&pg->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Fill in one pollfd per ring, which becomes readable once the ring is
+ * half full and needs draining before the end of the interval.
+ */
+int irqtrace_pollfds(struct pollfd *pfds)
+{
+	int i;
+
+	for (i = 0; i < nr_rings; i++) {
+		pfds[i].fd = rings[i].fds[0];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+
+	return nr_rings;
+}
+
+int irqtrace_nr_pollfds(void)
+{
+	return nr_rings;
+}
+
+void irqtrace_drain(void)
+{
+	int i;
+
+	for (i = 0; i < nr_rings; i++)
+		drain_ring(&rings[i]);
+}
+
+/*
+ * Hand out the handler times measured since the last call
+ */
+struct irqtrace_sample *irqtrace_collect(void)
+{
+	struct irqtrace_sample *sample;
+
+	if (!totals)
+		return NULL;
+
+	irqtrace_drain();
+
+	if (lost_samples) {
+		log(TO_CONSOLE, LOG_WARNING, "irqtrace: lost %lu samples, handler times are too low\n",
+		    lost_samples);
+		lost_samples = 0;
+	}
+
+	sample = totals;
+	totals = alloc_irqtrace_sample(sample->nr_cpus);
+	if (!totals) {
+		/* keep accumulating into the old totals */
+		totals = sample;
+		return NULL;
+	}
+
+	return sample;
+}
+
+void deinit_irqtrace(void)
+{
+	int i;
+
+	for (i = 0; i < nr_rings; i++)
+		close_ring(&rings[i]);
+	free(rings);
+	rings = NULL;
+	nr_rings = 0;
+	free_irqtrace_sample(totals);
+	totals = NULL;
+	cpus_clear(traced_cpus);
+}
+
+/*
+ * return value: TRUE with an error; otherwise, FALSE
+ */
+gboolean init_irqtrace(void)
+{
+	const char **dir;
+	long nr_cpus;
+	int i, cpu;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpus <= 0 || nr_cpus > NR_CPUS) {
+		log(TO_ALL, LOG_WARNING, "irqtrace: unable to determine the number of cpus.\n");
+		return TRUE;
+	}
+
+	for (dir = tracefs_dirs; *dir; dir++) {
+		for (i = 0; i < EV_MAX; i++)
+			if (read_event_format(*dir, &events[i]))
+				break;
+		if (i == EV_MAX)
+			break;
+	}
+	if (!*dir) {
+		log(TO_ALL, LOG_WARNING, "irqtrace: irq tracepoints not found, is tracefs mounted?\n");
+		return TRUE;
+	}
+
+	rings = calloc(nr_cpus, sizeof(struct trace_ring));
+	totals = alloc_irqtrace_sample(nr_cpus);
+	if (!rings || !totals)
+		goto err;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (open_ring(&rings[nr_rings], cpu) < 0) {
+			/* offline cpus can't be traced */
+			if (errno == ENODEV)
+				continue;
+			log(TO_ALL, LOG_WARNING, "irqtrace: unable to trace cpu %d: %s\n",
+			    cpu, strerror(errno));
+			goto err;
+		}
+		cpu_set(cpu, traced_cpus);
+		nr_rings++;
+	}
+	cpus_copy(totals->cpus, traced_cpus);
+
+	log(TO_CONSOLE, LOG_INFO, "irqtrace: tracing irq handlers on %d cpus\n", nr_rings);
+	return FALSE;
+err:
+	deinit_irqtrace();
+	return TRUE;
+}
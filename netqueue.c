@@ -0,0 +1,280 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the network queue alignment.  The kernel steers
+ * transmit completion and receive processing of each queue of a network
+ * device to the cpus in its xps_cpus and rps_cpus masks.  If the irq of
+ * the queue fires elsewhere, packets bounce between cores.  Depending on
+ * the mode, irqs are either kept on the cpus of their queue's masks, or
+ * the masks are rewritten to follow the irqs.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "irqbalance.h"
+
+#define SYSNET_DIR	"/sys/class/net"
+
+int netqueue_mode = NETQUEUE_OFF;
+
+static const struct {
+	const char *marker;
+	int dirs;
+} queue_markers[] = {
+	{ "txrx",	QUEUE_RX | QUEUE_TX },
+	{ "input",	QUEUE_RX },
+	{ "output",	QUEUE_TX },
+	{ "comp",	QUEUE_RX | QUEUE_TX },
+	{ "fp",		QUEUE_RX | QUEUE_TX },
+	{ "queue",	QUEUE_RX | QUEUE_TX },
+	{ "rx",		QUEUE_RX },
+	{ "tx",		QUEUE_TX },
+};
+
+/*
+ * Drivers name queue vectors like eth0-TxRx-3, ens1f0-rx-2, mlx5_comp3 or
+ * virtio0-input.0.  Find the queue number after the marker naming the
+ * kind of queue; vectors without one, e.g. for link events, serve no queue.
+ */
+static int parse_queue_name(const char *name, int *dirs)
+{
+	char lower[64], *p;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(lower) - 1 && name[i] && name[i] != '@' && name[i] != ' '; i++)
+		lower[i] = tolower(name[i]);
+	lower[i] = '\0';
+
+	for (i = 0; i < G_N_ELEMENTS(queue_markers); i++) {
+		p = strstr(lower, queue_markers[i].marker);
+		if (!p)
+			continue;
+		p += strlen(queue_markers[i].marker);
+		while (*p && !isdigit(*p))
+			p++;
+		if (!*p)
+			continue;
+		*dirs = queue_markers[i].dirs;
+		return strtol(p, NULL, 10);
+	}
+
+	return -1;
+}
+
+/* the network devices of the pci function behind a netdev */
+static int function_netdevs(const char *netdev)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int count = 0;
+
+	snprintf(path, PATH_MAX, "%s/%s/device/net", SYSNET_DIR, netdev);
+	dir = opendir(path);
+	if (!dir)
+		return 1;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] != '.')
+			count++;
+	}
+	closedir(dir);
+
+	return count;
+}
+
+static void map_netdev_queues(const char *netdev)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	struct irq_info *info;
+	DIR *dir;
+	int queue, dirs, shared;
+
+	shared = function_netdevs(netdev) > 1;
+
+	snprintf(path, PATH_MAX, "%s/%s/device/msi_irqs", SYSNET_DIR, netdev);
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		info = get_irq_info(strtol(entry->d_name, NULL, 10));
+		if (!info || !info->name || info->netdev)
+			continue;
+
+		/*
+		 * the vectors of a function with several ports are all under each
+		 * of them, only those naming the port belong to it
+		 */
+		if (shared && !strstr(info->name, netdev))
+			continue;
+
+		queue = parse_queue_name(info->name, &dirs);
+		if (queue < 0)
+			continue;
+
+		info->netdev = strdup(netdev);
+		info->queue = queue;
+		info->queue_dirs = dirs;
+		log(TO_CONSOLE, LOG_INFO, "IRQ %d serves queue %d of %s\n", info->irq, queue, netdev);
+	}
+	closedir(dir);
+}
+
+/*
+ * Find the network device queue each msi vector serves.  Called once the
+ * irq database is built, when the irqs have their /proc/interrupts names.
+ */
+void map_net_queues(void)
+{
+	struct dirent *entry;
+	DIR *dir;
+
+	if (netqueue_mode == NETQUEUE_OFF)
+		return;
+
+	dir = opendir(SYSNET_DIR);
+	if (!dir)
+		return;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] != '.')
+			map_netdev_queues(entry->d_name);
+	}
+	closedir(dir);
+}
+
+/*
+ * The masks the irqs are aligned with are sampled by the collector.  Those
+ * about to be rewritten are read fresh, the snapshot may predate the last
+ * rewrite.
+ */
+static int read_queue_mask(struct irq_info *info, const char *file, cpumask_t *mask,
+			   int fresh)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s/%s/queues/%s-%d/%s", SYSNET_DIR, info->netdev,
+		 strcmp(file, "rps_cpus") ? "tx" : "rx", info->queue, file);
+	cpus_clear(*mask);
+	if (fresh)
+		return process_one_line(path, get_mask_from_bitmap, mask);
+	return read_sampled_line(path, get_mask_from_bitmap, mask);
+}
+
+static void write_queue_mask(struct irq_info *info, const char *file, cpumask_t mask)
+{
+	char path[PATH_MAX], buf[PATH_MAX];
+	FILE *f;
+
+	if (dry_run) {
+		cpumask_scnprintf(buf, PATH_MAX, mask);
+		log(TO_CONSOLE, LOG_INFO, "%s of %s queue %d would follow irq %d: %s\n", file,
+		    info->netdev, info->queue, info->irq, buf);
+		return;
+	}
+
+	snprintf(path, PATH_MAX, "%s/%s/queues/%s-%d/%s", SYSNET_DIR, info->netdev,
+		 strcmp(file, "rps_cpus") ? "tx" : "rx", info->queue, file);
+	f = fopen(path, "w");
+	if (!f)
+		return;
+	cpumask_scnprintf(buf, PATH_MAX, mask);
+	if (fprintf(f, "%s", buf) < 0 || fclose(f)) {
+		log(TO_ALL, LOG_DEBUG, "Cannot write %s of %s queue %d\n", file,
+		    info->netdev, info->queue);
+		return;
+	}
+	log(TO_CONSOLE, LOG_INFO, "%s of %s queue %d follows irq %d: %s\n", file,
+	    info->netdev, info->queue, info->irq, buf);
+}
+
+/* the cpus the kernel steers the queue's processing to */
+static void queue_cpus(struct irq_info *info, cpumask_t *mask)
+{
+	cpumask_t queue_mask;
+
+	cpus_clear(*mask);
+	if ((info->queue_dirs & QUEUE_TX) && !read_queue_mask(info, "xps_cpus", &queue_mask, 0))
+		cpus_or(*mask, *mask, queue_mask);
+	if ((info->queue_dirs & QUEUE_RX) && !read_queue_mask(info, "rps_cpus", &queue_mask, 0))
+		cpus_or(*mask, *mask, queue_mask);
+}
+
+static void align_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	cpumask_t mask;
+
+	/* an explicit cgroup policy wins */
+	if (!info->netdev || info->cgroup)
+		return;
+
+	queue_cpus(info, &mask);
+	cpus_and(mask, mask, unbanned_cpus);
+	if (cpus_equal(mask, info->colocate_mask))
+		return;
+
+	info->colocate_mask = mask;
+	if (info->assigned_obj && outside_colocation(info, info->assigned_obj))
+		force_rebalance_irq(info, NULL);
+}
+
+/*
+ * Keep the irqs of network queues on the cpus xps and rps steer their
+ * queues to.  Queues without masks leave their irqs free to move.
+ */
+void align_net_queues(void)
+{
+	if (netqueue_mode == NETQUEUE_ALIGN)
+		for_each_irq(NULL, align_irq, NULL);
+}
+
+static void steer_queue(struct irq_info *info, void *data __attribute__((unused)))
+{
+	cpumask_t mask, queue_mask;
+
+	if (!info->netdev || !info->assigned_obj)
+		return;
+
+	cpus_and(mask, cpu_online_map, info->assigned_obj->mask);
+
+	if ((info->queue_dirs & QUEUE_TX) && !read_queue_mask(info, "xps_cpus", &queue_mask, 1) &&
+	    !cpus_equal(mask, queue_mask))
+		write_queue_mask(info, "xps_cpus", mask);
+
+	/* an empty rps mask has rps disabled, leave it that way */
+	if ((info->queue_dirs & QUEUE_RX) && !read_queue_mask(info, "rps_cpus", &queue_mask, 1) &&
+	    !cpus_empty(queue_mask) && !cpus_equal(mask, queue_mask))
+		write_queue_mask(info, "rps_cpus", mask);
+}
+
+/*
+ * Rewrite the xps and rps masks of network queues to the cpus their irqs
+ * were just moved to
+ */
+void steer_net_queues(void)
+{
+	if (netqueue_mode == NETQUEUE_REWRITE)
+		for_each_irq(NULL, steer_queue, NULL);
+}
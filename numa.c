@@ -38,10 +38,18 @@
 #define SYSFS_NODE_PATH "/sys/devices/system/node"
 
 GList *numa_nodes = NULL;
+int numa_avail;
 
-static void add_one_node(int nodeid)
+/* node_distance[from * nr_distance_nodes + to], as reported by the kernel */
+static int *node_distance;
+static int nr_distance_nodes;
+
+/*
+ * Add a node with the given cpus to the tree, the sysfs independent part
+ * of building the node list
+ */
+void add_numa_node(int nodeid, cpumask_t mask)
 {
-	char path[PATH_MAX];
 	struct topo_obj *new;
 
 	new = calloc(1, sizeof(struct topo_obj));
@@ -50,18 +58,148 @@ static void add_one_node(int nodeid)
 		return;
 	}
 
+	new->mask = mask;
+	new->obj_type = OBJ_TYPE_NODE;	
+	new->level = BALANCE_NONE;
+	new->number = nodeid;
+	new->obj_type_list = &numa_nodes;
+	numa_nodes = g_list_append(numa_nodes, new);
+}
+
+static void add_one_node(int nodeid)
+{
+	char path[PATH_MAX];
+	cpumask_t mask;
+
 	if (nodeid == NUMA_NO_NODE) {
-		cpus_setall(new->mask);
+		cpus_setall(mask);
 	} else {
-		cpus_clear(new->mask);
+		cpus_clear(mask);
 		sprintf(path, "%s/node%d/cpumap", SYSFS_NODE_PATH, nodeid);
-		process_one_line(path, get_mask_from_bitmap, &new->mask);
+		process_one_line(path, get_mask_from_bitmap, &mask);
 	}
 
-	new->obj_type = OBJ_TYPE_NODE;	
-	new->number = nodeid;
-	new->obj_type_list = &numa_nodes;
-	numa_nodes = g_list_append(numa_nodes, new);
+	add_numa_node(nodeid, mask);
+}
+
+static gint compare_node_number(gconstpointer a, gconstpointer b)
+{
+	const struct topo_obj *ai = a;
+	const struct topo_obj *bi = b;
+
+	return ai->number - bi->number;
+}
+
+/*
+ * Size the distance table for the nodes in the list, with the default
+ * local and remote distances.  Returns the nodes sorted by number, for
+ * the caller to free.
+ */
+static GList *init_node_distances(void)
+{
+	GList *sorted;
+	struct topo_obj *node;
+	int i;
+
+	sorted = g_list_sort(g_list_copy(numa_nodes), compare_node_number);
+	if (!sorted)
+		return NULL;
+	node = g_list_last(sorted)->data;
+	nr_distance_nodes = node->number + 1;
+	if (nr_distance_nodes <= 0)
+		return sorted;
+
+	node_distance = malloc(nr_distance_nodes * nr_distance_nodes * sizeof(int));
+	if (!node_distance) {
+		nr_distance_nodes = 0;
+		return sorted;
+	}
+	for (i = 0; i < nr_distance_nodes * nr_distance_nodes; i++)
+		node_distance[i] = (i / nr_distance_nodes == i % nr_distance_nodes) ?
+			NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+
+	return sorted;
+}
+
+/*
+ * Start the distances between the nodes added so far over from the
+ * defaults, to be refined with set_numa_node_distance()
+ */
+void reset_numa_node_distances(void)
+{
+	free(node_distance);
+	node_distance = NULL;
+	nr_distance_nodes = 0;
+	g_list_free(init_node_distances());
+}
+
+void set_numa_node_distance(int from, int to, int distance)
+{
+	if (from < 0 || to < 0 || from >= nr_distance_nodes || to >= nr_distance_nodes)
+		return;
+
+	node_distance[from * nr_distance_nodes + to] = distance;
+}
+
+/*
+ * Each node's distance file lists its distance to every online node, in
+ * order of node number
+ */
+static void read_node_distances(void)
+{
+	char path[PATH_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	GList *sorted, *from, *to;
+	struct topo_obj *node;
+	FILE *file;
+	char *c, *c2;
+
+	sorted = init_node_distances();
+	if (!nr_distance_nodes)
+		goto out;
+
+	for (from = g_list_first(sorted); from; from = g_list_next(from)) {
+		node = from->data;
+		if (node->number == NUMA_NO_NODE)
+			continue;
+
+		sprintf(path, "%s/node%d/distance", SYSFS_NODE_PATH, node->number);
+		file = fopen(path, "r");
+		if (!file)
+			continue;
+		if (getline(&line, &size, file) > 0) {
+			c = line;
+			for (to = g_list_first(sorted); to; to = g_list_next(to)) {
+				struct topo_obj *dest = to->data;
+				int distance;
+
+				if (dest->number == NUMA_NO_NODE)
+					continue;
+				distance = strtoul(c, &c2, 10);
+				if (c == c2)
+					break;
+				c = c2;
+				set_numa_node_distance(node->number, dest->number, distance);
+			}
+		}
+		fclose(file);
+	}
+	free(line);
+out:
+	g_list_free(sorted);
+}
+
+/*
+ * Distance between two nodes, local distance if either one is unknown
+ */
+int numa_node_distance(int from, int to)
+{
+	if (from == to || from < 0 || to < 0 ||
+	    from >= nr_distance_nodes || to >= nr_distance_nodes)
+		return NUMA_LOCAL_DISTANCE;
+
+	return node_distance[from * nr_distance_nodes + to];
 }
 
 void build_numa_node_list(void)
@@ -90,12 +228,17 @@ void build_numa_node_list(void)
 		}
 	} while (entry);
 	closedir(dir);
+
+	read_node_distances();
 }
 
 void free_numa_node_list(void)
 {
 	g_list_free_full(numa_nodes, free_cpu_topo);
 	numa_nodes = NULL;
+	free(node_distance);
+	node_distance = NULL;
+	nr_distance_nodes = 0;
 }
 
 static gint compare_node(gconstpointer a, gconstpointer b)
@@ -139,6 +282,14 @@ void dump_numa_node_info(struct topo_obj *d, void *unused __attribute__((unused)
 	log(TO_CONSOLE, LOG_INFO, "NUMA NODE NUMBER: %d\n", d->number);
 	cpumask_scnprintf(buffer, 4096, d->mask); 
 	log(TO_CONSOLE, LOG_INFO, "LOCAL CPU MASK: %s\n", buffer);
+	if (d->number != NUMA_NO_NODE && nr_distance_nodes) {
+		int i;
+
+		log(TO_CONSOLE, LOG_INFO, "DISTANCES:");
+		for (i = 0; i < nr_distance_nodes; i++)
+			log(TO_CONSOLE, LOG_INFO, " %d", numa_node_distance(d->number, i));
+		log(TO_CONSOLE, LOG_INFO, "\n");
+	}
 	log(TO_CONSOLE, LOG_INFO, "\n");
 }
 
@@ -24,23 +24,110 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "types.h"
 #include "irqbalance.h"
 
 
 GList *rebalance_irq_list;
+unsigned long smt_threshold;
 
 struct obj_placement {
 		struct topo_obj *best;
 		uint64_t best_cost;
+		int best_distance;
+		int best_busy;
+		int best_stolen;
+		int best_asleep;
+		int best_queues;
+		int best_cpus;
 		struct irq_info *info;
 };
 
+/*
+ * An irq firing at more than smt_threshold interrupts per second is worth
+ * a physical core of its own, sibling threads share its execution units
+ */
+static int irq_is_high_rate(struct irq_info *info)
+{
+	uint64_t count = info->irq_count - info->last_irq_count;
+
+	if (!smt_threshold)
+		return 0;
+
+	/* intervals cut short by pressure or cgroup events are shorter than the sleep */
+	if (!stat_interval)
+		return count >= smt_threshold * sleep_interval;
+	return count * NSEC_PER_SEC / stat_interval >= smt_threshold;
+}
+
+static void count_high_rate_irq(struct irq_info *info, void *data)
+{
+	if (irq_is_high_rate(info))
+		(*(int *)data)++;
+}
+
+static void count_high_rate_irqs(struct topo_obj *d, void *data)
+{
+	if (d->interrupts)
+		for_each_irq(d->interrupts, count_high_rate_irq, data);
+	for_each_object(d->children, count_high_rate_irqs, data);
+}
+
+/*
+ * Paravirtual irqs are only serviced while their vcpu runs, so in a guest
+ * they are kept off cpus the hypervisor takes away for more than a quarter
+ * of the time.  A host with virtio devices, as used by vhost or vfio, has
+ * no vcpus to lose and balances them as usual.
+ */
+#define STOLEN_AVAIL	(CAPACITY_SCALE * 3 / 4)
+
+static int irq_is_paravirt(struct irq_info *info)
+{
+	if (!steal_reported)
+		return 0;
+	return info->class == IRQ_VIRT_EVENT ||
+	       (info->name && strstr(info->name, "virtio"));
+}
+
+struct device_queues {
+	int device;
+	int count;
+};
+
+static void count_device_queue(struct irq_info *info, void *data)
+{
+	struct device_queues *queues = data;
+
+	if (info->device == queues->device)
+		queues->count++;
+}
+
+static void count_device_queues(struct topo_obj *d, void *data)
+{
+	if (d->interrupts)
+		for_each_irq(d->interrupts, count_device_queue, data);
+	for_each_object(d->children, count_device_queues, data);
+}
+
+static int compare_key(uint64_t mine, uint64_t theirs)
+{
+	return (mine > theirs) - (mine < theirs);
+}
+
 static void find_best_object(struct topo_obj *d, void *data)
 {
 	struct obj_placement *best = (struct obj_placement *)data;
 	uint64_t newload;
+	int distance = NUMA_LOCAL_DISTANCE;
+	int busy = 0;
+	int stolen = 0;
+	int asleep = 0;
+	struct device_queues queues = { 0, 0 };
+	cpumask_t usable;
+	int ncpus = 1;
+	int rank = 0;
 
 	/*
  	 * Don't consider the unspecified numa node here
@@ -62,17 +149,104 @@ static void find_best_object(struct topo_obj *d, void *data)
 	if (d->slots_left <= 0)
 		return;
 
-	newload = d->load;
-	if (newload < best->best_cost) {
+	if (obj_is_dedicated(d) || obj_is_quarantined(d))
+		return;
+
+	if (misses_colocation(best->info, d))
+		return;
+
+	newload = obj_cost(d);
+
+	/*
+	 * Handling an irq away from its device's node makes it more
+	 * expensive, so weigh in its own load scaled by the distance
+	 */
+	if (d->obj_type == OBJ_TYPE_NODE) {
+		distance = numa_node_distance(irq_numa_node(best->info)->number, d->number);
+		newload += best->info->load * distance / NUMA_LOCAL_DISTANCE;
+	}
+
+	/* slower or throttled cpus count as busier for the same load */
+	newload = capacity_load(d, newload);
+
+	/*
+	 * The rules below override load, in this order.  Every candidate
+	 * gets all of their keys, so that they compare as one tuple.
+	 */
+	if (irq_is_paravirt(best->info))
+		stolen = d->avail < STOLEN_AVAIL;
+
+	/*
+	 * Every interrupt of a latency sensitive irq waits for a sleeping
+	 * cpu to wake up, keep them on cpus that are awake anyway
+	 */
+	if (irq_is_latency_sensitive(best->info))
+		asleep = obj_is_asleep(d);
+
+	/*
+	 * Spread the queues of a multi queue device evenly, so that every
+	 * core and cache gets one before any gets a second.  Compares the
+	 * queues per usable cpu of the candidates.
+	 */
+	if (best->info->device) {
+		queues.device = best->info->device;
+		count_device_queues(d, &queues);
+		cpus_and(usable, d->mask, unbanned_cpus);
+		ncpus = MAX(cpus_weight(usable), 1);
+	}
+
+	/*
+	 * Spread high rate irqs over physical cores before doubling them
+	 * up on sibling threads
+	 */
+	if (d->level >= BALANCE_SMT && irq_is_high_rate(best->info))
+		count_high_rate_irqs(d, &busy);
+
+	/*
+	 * A candidate losing on a rule is skipped, one winning on it
+	 * replaces the best so far whatever its load
+	 */
+	if (best->best) {
+		rank = compare_key(stolen, best->best_stolen);
+		if (!rank)
+			rank = compare_key(asleep, best->best_asleep);
+		if (!rank)
+			rank = compare_key((uint64_t)queues.count * best->best_cpus,
+					   (uint64_t)best->best_queues * ncpus);
+		if (!rank)
+			rank = compare_key(busy, best->best_busy);
+		if (rank > 0)
+			return;
+	}
+
+	if (rank < 0 || newload < best->best_cost ||
+	    (newload == best->best_cost &&
+	     (!best->best || distance < best->best_distance ||
+	      (distance == best->best_distance &&
+	       g_list_length(d->interrupts) < g_list_length(best->best->interrupts))))) {
 		best->best = d;
 		best->best_cost = newload;
-	} else if (newload == best->best_cost) {
-		if (!best->best || g_list_length(d->interrupts) < g_list_length(best->best->interrupts)) {
-			best->best = d;
-		}
+		best->best_distance = distance;
+		best->best_busy = busy;
+		best->best_stolen = stolen;
+		best->best_asleep = asleep;
+		best->best_queues = queues.count;
+		best->best_cpus = ncpus;
 	}
 }
 
+/*
+ * Whether the rules keep an irq off an object whatever its load, so that
+ * the load balancing doesn't pick irqs that would only land where they
+ * were
+ */
+int irq_shuns_obj(struct irq_info *info, struct topo_obj *d)
+{
+	return (irq_is_paravirt(info) && d->avail < STOLEN_AVAIL) ||
+	       (irq_is_latency_sensitive(info) && obj_is_asleep(d)) ||
+	       misses_colocation(info, d);
+}
+
 static void find_best_object_for_irq(struct irq_info *info, void *data)
 {
 	struct obj_placement place;
@@ -81,31 +255,22 @@ static void find_best_object_for_irq(struct irq_info *info, void *data)
 	if (!info->moved)
 		return;
 
-	switch (d->obj_type) {
-	case OBJ_TYPE_NODE:
-		if (info->level == BALANCE_NONE)
-			return;
-		break;
-
-	case OBJ_TYPE_PACKAGE:
-		if (info->level == BALANCE_PACKAGE)
-			return;
-		break;
-
-	case OBJ_TYPE_CACHE:
-		if (info->level == BALANCE_CACHE)
-			return;
-		break;
-
-	case OBJ_TYPE_CPU:
-		if (info->level == BALANCE_CORE)
-			return;
-		break;
-	}
+	/*
+	 * the irq doesn't want to be placed any deeper than this, unless it
+	 * has to go deeper to stay within its cgroup
+	 */
+	if (d->level >= info->level && !outside_colocation(info, d))
+		return;
 
 	place.info = info;
 	place.best = NULL;
 	place.best_cost = ULLONG_MAX;
+	place.best_distance = NUMA_LOCAL_DISTANCE;
+	place.best_busy = 0;
+	place.best_stolen = 0;
+	place.best_asleep = 0;
+	place.best_queues = 0;
+	place.best_cpus = 1;
 
 	for_each_object(d->children, find_best_object, &place);
 
@@ -137,6 +302,14 @@ static void place_irq_in_node(struct irq_info *info, void *data __attribute__((u
 			goto find_placement;
 		}
 
+		/* the cgroup or hint the irq follows may be on other nodes */
+		if (misses_colocation(info, irq_numa_node(info)))
+			goto find_placement;
+
+		/* all of the node is parked, go to the nearest one that isn't */
+		if (irq_numa_node(info)->powersave_mode)
+			goto find_placement;
+
 		/*
 		 * This irq belongs to a device with a preferred numa node
 		 * put it on that node
@@ -148,13 +321,24 @@ static void place_irq_in_node(struct irq_info *info, void *data __attribute__((u
 
 find_placement:
 	place.best_cost = ULLONG_MAX;
+	place.best_distance = NUMA_LOCAL_DISTANCE;
+	place.best_busy = 0;
+	place.best_stolen = 0;
+	place.best_asleep = 0;
+	place.best_queues = 0;
+	place.best_cpus = 1;
 	place.best = NULL;
 	place.info = info;
 
 	for_each_object(numa_nodes, find_best_object, &place);
 
-	if (place.best)
+	if (place.best) {
+		if (irq_numa_node(info)->number != NUMA_NO_NODE)
+			log(TO_CONSOLE, LOG_INFO, "irq %d placed on node %d, distance %d from node %d\n",
+			    info->irq, place.best->number, place.best_distance,
+			    irq_numa_node(info)->number);
 		migrate_irq_obj(NULL, place.best, info);
+	}
 }
 
 static void validate_irq(struct irq_info *info, void *data)
@@ -0,0 +1,147 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the irq pressure trigger.  Kernels with irq time
+ * accounting report in /proc/pressure/irq how long tasks were stalled by
+ * interrupt handling.  When enabled, a PSI trigger on it wakes the
+ * balancer before the end of the sleep interval whenever the stall time in
+ * a window exceeds the configured threshold, at most once per interval.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "irqbalance.h"
+
+#define PRESSURE_PATH	"/proc/pressure/irq"
+
+/* stall threshold in us per window, 0 disables the trigger */
+unsigned long pressure_threshold = 0;
+unsigned long pressure_window = 2000000;
+
+static int trigger_fd = -1;
+static guint trigger_source;
+static unsigned long trigger_count;
+static gint64 last_trigger;
+
+static gboolean pressure_triggered(gint fd __attribute__((unused)), GIOCondition condition,
+				   gpointer user_data __attribute__((unused)))
+{
+	gint64 now;
+
+	if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		log(TO_ALL, LOG_WARNING, "irq pressure trigger went away.\n");
+		trigger_source = 0;
+		return FALSE;
+	}
+
+	/*
+	 * sustained pressure fires every window, don't let it turn into a
+	 * rebalance every window
+	 */
+	now = g_get_monotonic_time();
+	if (last_trigger && now - last_trigger < g_atomic_int_get(&sleep_interval) * G_USEC_PER_SEC)
+		return TRUE;
+	last_trigger = now;
+
+	trigger_count++;
+	log(TO_CONSOLE, LOG_INFO, "irq pressure above threshold, rebalancing early\n");
+	kick_collector();
+
+	return TRUE;
+}
+
+/*
+ * Format the current irq pressure for the socket API, NULL if the kernel
+ * doesn't report it
+ */
+char *get_pressure_stat(void)
+{
+	char *line = NULL, *stat = NULL;
+	size_t size = 0;
+	FILE *file;
+
+	file = fopen(PRESSURE_PATH, "r");
+	if (!file)
+		return NULL;
+
+	/* irq pressure only has a "full" line */
+	while (getline(&line, &size, file) > 0) {
+		if (!g_str_has_prefix(line, "full "))
+			continue;
+		g_strstrip(line);
+		stat = g_strdup_printf("%s threshold=%lu window=%lu triggers=%lu",
+				       line, trigger_fd >= 0 ? pressure_threshold : 0,
+				       pressure_window, trigger_count);
+		break;
+	}
+
+	free(line);
+	fclose(file);
+	return stat;
+}
+
+void deinit_pressure(void)
+{
+	if (trigger_source) {
+		g_source_remove(trigger_source);
+		trigger_source = 0;
+	}
+	if (trigger_fd >= 0) {
+		close(trigger_fd);
+		trigger_fd = -1;
+	}
+}
+
+/*
+ * return value: TRUE with an error; otherwise, FALSE
+ */
+gboolean init_pressure(void)
+{
+	char trigger[64];
+	int len;
+
+	if (!pressure_threshold)
+		return FALSE;
+
+	trigger_fd = open(PRESSURE_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (trigger_fd < 0) {
+		/* not an error, the kernel lacks irq time accounting */
+		log(TO_CONSOLE, LOG_INFO, "irq pressure is not available.\n");
+		return FALSE;
+	}
+
+	len = snprintf(trigger, sizeof(trigger), "full %lu %lu",
+		       pressure_threshold, pressure_window);
+	if (write(trigger_fd, trigger, len + 1) < 0) {
+		log(TO_ALL, LOG_WARNING, "Failed to set irq pressure trigger: %s\n",
+		    strerror(errno));
+		deinit_pressure();
+		return TRUE;
+	}
+
+	trigger_source = g_unix_fd_add(trigger_fd, G_IO_PRI | G_IO_ERR | G_IO_HUP,
+				       pressure_triggered, NULL);
+	return FALSE;
+}
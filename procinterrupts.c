@@ -43,6 +43,16 @@
 static int proc_int_has_msi = 0;
 static int msi_found_in_sysfs = 0;
 
+/* ns the last interval lasted, by the clock of the cpus' stat times */
+uint64_t stat_interval;
+
+/* a hypervisor reports steal time, so this is a guest */
+int steal_reported;
+
+long HZ;
+int need_rescan;
+unsigned long app_load_weight = 0;
+
 #ifdef AARCH64
 struct irq_match {
 	char *matchstring;
@@ -262,23 +272,54 @@ GList* collect_full_irq_list(void)
 	return tmp_list;
 }
 
+/*
+ * Map the columns of a per cpu procfs table to cpu numbers from the
+ * "CPU0 CPU1 ..." header line.  Returns the number of columns.
+ */
+static int parse_cpu_columns(char *line, int **colcpu)
+{
+	int *cols = NULL, *newcols;
+	int nr = 0;
+	char *c = line;
+
+	while ((c = strstr(c, "CPU"))) {
+		newcols = realloc(cols, (nr + 1) * sizeof(int));
+		if (!newcols)
+			break;
+		cols = newcols;
+		cols[nr++] = strtoul(c + 3, &c, 10);
+	}
+
+	*colcpu = cols;
+	return nr;
+}
+
+static void clear_class_irq_count(struct topo_obj *d, void *data __attribute__((unused)))
+{
+	memset(d->class_irq_count, 0, sizeof(d->class_irq_count));
+}
+
 void parse_proc_interrupts(void)
 {
 	FILE *file;
 	char *line = NULL;
 	size_t size = 0;
+	int *colcpu = NULL;
+	int cols;
 	int ret;
 
-	file = fopen("/proc/interrupts", "r");
+	file = open_proc_source(PROC_INTERRUPTS);
 	if (!file)
 		return;
 
-	/* first line is the header we don't need; nuke it */
+	/* the header names the cpu of each column */
 	if (getline(&line, &size, file)<=0) {
 		free(line);
 		fclose(file);
 		return;
 	}
+	cols = parse_cpu_columns(line, &colcpu);
+	for_each_object(cpus, clear_class_irq_count, NULL);
 
 	while (!feof(file)) {
 		int cpunr;
@@ -336,6 +377,11 @@ void parse_proc_interrupts(void)
 			if (c==c2 || !strchr(" \t", *c2)) /* end of numbers */
 				break;
 			count += C;
+			if (cpunr < cols && info->class >= 0 && info->class < IRQ_CLASSES) {
+				struct topo_obj *cpu = find_cpu_core(colcpu[cpunr]);
+				if (cpu)
+					cpu->class_irq_count[info->class] += C;
+			}
 			c=c2;
 			cpunr++;
 		}
@@ -371,14 +417,41 @@ void parse_proc_interrupts(void)
 	if (!need_rescan)
 		clear_no_existing_irqs();
 	fclose(file);
+	free(colcpu);
 	free(line);
 }
 
 
+/*
+ * Map an irq class to the softirq group whose time it is charged with
+ */
+static int irq_softirq_group(struct irq_info *info)
+{
+	switch (info->class) {
+	case IRQ_ETH:
+	case IRQ_GBETH:
+	case IRQ_10GBETH:
+		return SOFTIRQ_NET;
+	case IRQ_SCSI:
+		return SOFTIRQ_BLOCK;
+	default:
+		return SOFTIRQ_OTHER;
+	}
+}
+
+/* load per unit of weighted interrupt count */
+struct load_slice {
+	long double generic;
+	long double softirq[SOFTIRQ_GROUPS];
+};
+
 static void assign_load_slice(struct irq_info *info, void *data)
 {
-	uint64_t *load_slice = data;
-	info->load = (info->irq_count - info->last_irq_count) * *load_slice;
+	struct load_slice *load_slice = data;
+	uint64_t cost = (info->irq_count - info->last_irq_count) * irq_cost_weight(info);
+
+	info->load = cost * (load_slice->generic + load_slice->softirq[irq_softirq_group(info)]);
+	info->load += info->handler_time;
 
 	/*
  	 * Every IRQ has at least a load of 1
@@ -387,44 +460,88 @@ static void assign_load_slice(struct irq_info *info, void *data)
 		info->load++;
 }
 
+/*
+ * Cost weighted number of interrupts handled by this object in the last
+ * interval, either in total (SOFTIRQ_OTHER) or for the irqs of one
+ * softirq group
+ */
+static uint64_t get_irq_count(struct topo_obj *d, int group)
+{
+	return (group == SOFTIRQ_OTHER) ? d->irq_count : d->softirq_irq_count[group];
+}
+
 /*
  * Recursive helper to estimate the number of irqs shared between 
  * multiple topology objects that was handled by this particular object
  */
-static uint64_t get_parent_branch_irq_count_share(struct topo_obj *d)
+static uint64_t get_parent_branch_irq_count_share(struct topo_obj *d, int group)
 {
 	uint64_t total_irq_count = 0;
 
 	if (d->parent) {
-		total_irq_count = get_parent_branch_irq_count_share(d->parent);
+		total_irq_count = get_parent_branch_irq_count_share(d->parent, group);
 		total_irq_count /= g_list_length((d->parent)->children);
 	}
 
-	total_irq_count += d->irq_count;
+	total_irq_count += get_irq_count(d, group);
 
 	return total_irq_count;
 }
 
+struct branch_irq_count {
+	int group;
+	uint64_t count;
+};
+
 static void get_children_branch_irq_count(struct topo_obj *d, void *data)
 {
-	uint64_t *total_irq_count = data;
+	struct branch_irq_count *total = data;
+
+	if (g_list_length(d->children) > 0)
+		for_each_object(d->children, get_children_branch_irq_count, total);
+
+	total->count += get_irq_count(d, total->group);
+}
+
+static uint64_t get_branch_irq_count(struct topo_obj *d, int group)
+{
+	struct branch_irq_count total;
 
+	total.group = group;
+	total.count = get_parent_branch_irq_count_share(d, group);
 	if (g_list_length(d->children) > 0)
-		for_each_object(d->children, get_children_branch_irq_count, total_irq_count);
+		for_each_object(d->children, get_children_branch_irq_count, &total);
 
-	*total_irq_count += d->irq_count;
+	return total.count;
 }
 
 static void compute_irq_branch_load_share(struct topo_obj *d, void *data __attribute__((unused)))
 {
 	uint64_t local_irq_counts = 0;
-	uint64_t load_slice;
+	uint64_t generic_load = d->load - MIN(d->load, d->hardirq_load);
+	struct load_slice load_slice;
+	int group;
 
 	if (g_list_length(d->interrupts) > 0) {
-		local_irq_counts = get_parent_branch_irq_count_share(d);
-		if (g_list_length(d->children) > 0)
-			for_each_object(d->children, get_children_branch_irq_count, &local_irq_counts);
-		load_slice = local_irq_counts ? (d->load / local_irq_counts) : 1;
+		/*
+		 * Softirq time of the net and block groups is shared only
+		 * among the irqs raising it, as long as there are any in
+		 * this branch.  Everything else is shared among all irqs,
+		 * except for traced handler time that each irq gets directly.
+		 */
+		memset(&load_slice, 0, sizeof(load_slice));
+		for (group = 0; group < SOFTIRQ_OTHER; group++) {
+			if (!d->softirq_load[group])
+				continue;
+			local_irq_counts = get_branch_irq_count(d, group);
+			if (!local_irq_counts)
+				continue;
+			load_slice.softirq[group] = (long double)d->softirq_load[group] / local_irq_counts;
+			generic_load -= MIN(generic_load, d->softirq_load[group]);
+		}
+
+		local_irq_counts = get_branch_irq_count(d, SOFTIRQ_OTHER);
+		load_slice.generic = local_irq_counts ? ((long double)generic_load / local_irq_counts) : 1;
 		for_each_irq(d->interrupts, assign_load_slice, &load_slice);
 	}
 
@@ -432,9 +549,13 @@ static void compute_irq_branch_load_share(struct topo_obj *d, void *data __attri
 
 static void accumulate_irq_count(struct irq_info *info, void *data)
 {
-	uint64_t *acc = data;
+	struct topo_obj *d = data;
+	uint64_t cost = (info->irq_count - info->last_irq_count) * irq_cost_weight(info);
+	int group = irq_softirq_group(info);
 
-	*acc += (info->irq_count - info->last_irq_count);
+	d->irq_count += cost;
+	if (group != SOFTIRQ_OTHER)
+		d->softirq_irq_count[group] += cost;
 }
 
 static void accumulate_interrupts(struct topo_obj *d, void *data __attribute__((unused)))
@@ -444,15 +565,21 @@ static void accumulate_interrupts(struct topo_obj *d, void *data __attribute__((
 	}
 
 	d->irq_count = 0;
+	memset(d->softirq_irq_count, 0, sizeof(d->softirq_irq_count));
 	if (g_list_length(d->interrupts) > 0)
-		for_each_irq(d->interrupts, accumulate_irq_count, &(d->irq_count));
+		for_each_irq(d->interrupts, accumulate_irq_count, d);
 }
 
 static void accumulate_load(struct topo_obj *d, void *data)
 {
-	uint64_t *load = data;
-
-	*load += d->load;
+	struct topo_obj *parent = data;
+	int group;
+
+	parent->load += d->load;
+	parent->hardirq_load += d->hardirq_load;
+	parent->app_load += d->app_load;
+	for (group = 0; group < SOFTIRQ_GROUPS; group++)
+		parent->softirq_load[group] += d->softirq_load[group];
 }
 
 static void set_load(struct topo_obj *d, void *data __attribute__((unused)))
@@ -460,20 +587,261 @@ static void set_load(struct topo_obj *d, void *data __attribute__((unused)))
 	if (g_list_length(d->children) > 0) {
 		for_each_object(d->children, set_load, NULL);
 		d->load = 0;
-		for_each_object(d->children, accumulate_load, &(d->load));
+		d->hardirq_load = 0;
+		d->app_load = 0;
+		memset(d->softirq_load, 0, sizeof(d->softirq_load));
+		for_each_object(d->children, accumulate_load, d);
 	}
 }
 
-void parse_proc_stat(void)
+static int softirq_name_to_group(const char *name)
+{
+	if (!strcmp(name, "NET_TX") || !strcmp(name, "NET_RX"))
+		return SOFTIRQ_NET;
+	if (!strcmp(name, "BLOCK") || !strcmp(name, "IRQ_POLL"))
+		return SOFTIRQ_BLOCK;
+	return SOFTIRQ_OTHER;
+}
+
+/*
+ * /proc/softirqs only counts how often each softirq ran on a cpu.  Collect
+ * the per cpu deltas of these counts per group, parse_proc_stat() uses
+ * them to split the cpu's softirq time between the groups.
+ */
+static void parse_proc_softirqs(void)
 {
 	FILE *file;
 	char *line = NULL;
 	size_t size = 0;
-	int cpunr, rc, cpucount;
+	int *colcpu = NULL;
+	int cols = 0, i, group;
+	char *c, *c2;
 	struct topo_obj *cpu;
-	unsigned long long irq_load, softirq_load;
+	GList *entry;
+
+	file = open_proc_source(PROC_SOFTIRQS);
+	if (!file)
+		return;
+
+	/* the header names the cpu of each column */
+	if (getline(&line, &size, file) <= 0)
+		goto out;
+
+	cols = parse_cpu_columns(line, &colcpu);
+
+	for (entry = g_list_first(cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+		memset(cpu->softirq_count, 0, sizeof(cpu->softirq_count));
+	}
+
+	while (getline(&line, &size, file) > 0) {
+		c = strchr(line, ':');
+		if (!c)
+			continue;
+		*c++ = '\0';
+		group = softirq_name_to_group(g_strstrip(line));
+
+		for (i = 0; i < cols; i++) {
+			uint64_t count = strtoull(c, &c2, 10);
+			if (c == c2)
+				break;
+			c = c2;
+			cpu = find_cpu_core(colcpu[i]);
+			if (cpu)
+				cpu->softirq_count[group] += count;
+		}
+	}
+
+	/* turn the absolute counts into deltas since the last sample */
+	for (entry = g_list_first(cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+		for (group = 0; group < SOFTIRQ_GROUPS; group++) {
+			uint64_t count = cpu->softirq_count[group];
 
-	file = fopen("/proc/stat", "r");
+			cpu->softirq_count[group] = (count >= cpu->last_softirq_count[group]) ?
+				count - cpu->last_softirq_count[group] : 0;
+			cpu->last_softirq_count[group] = count;
+		}
+	}
+
+out:
+	free(colcpu);
+	free(line);
+	fclose(file);
+}
+
+/*
+ * Split the softirq time a cpu spent in the last interval between the
+ * softirq groups, proportional to how often each group ran
+ */
+static void split_softirq_load(struct topo_obj *cpu, uint64_t softirq_load)
+{
+	uint64_t total = 0;
+	int group;
+
+	for (group = 0; group < SOFTIRQ_GROUPS; group++)
+		total += cpu->softirq_count[group];
+
+	for (group = 0; group < SOFTIRQ_GROUPS; group++)
+		cpu->softirq_load[group] = total ?
+			(long double)softirq_load * cpu->softirq_count[group] / total : 0;
+}
+
+/*
+ * Turn the handler time of an irq into work at the top frequency, like the
+ * load of the cpus, by the average frequency of the traced cpus it may run on
+ */
+static uint64_t handler_work(struct irq_info *info, struct irqtrace_sample *trace, uint64_t time)
+{
+	struct topo_obj *cpu;
+	uint64_t scale = 0;
+	int count = 0;
+	GList *entry;
+
+	if (!info->assigned_obj)
+		return time;
+
+	for (entry = g_list_first(cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+		if (!cpu_isset(cpu->number, info->assigned_obj->mask) ||
+		    !cpu_isset(cpu->number, trace->cpus))
+			continue;
+		scale += cpu->freq_scale ? cpu->freq_scale : CAPACITY_SCALE;
+		count++;
+	}
+
+	return count ? time * scale / count / CAPACITY_SCALE : time;
+}
+
+static void set_handler_time(struct irq_info *info, void *data)
+{
+	struct irqtrace_sample *trace = data;
+
+	info->handler_time = (trace && info->irq < trace->nr_irqs) ?
+		handler_work(info, trace, trace->irq_time[info->irq]) : 0;
+}
+
+/*
+ * Replace the jiffies based load estimate of a cpu with the handler time
+ * traced on it.  Cpus that came online after the rings were opened have
+ * none, and keep the estimate from /proc/stat.
+ */
+static void apply_irqtrace(struct topo_obj *cpu, struct irqtrace_sample *trace)
+{
+	int group;
+
+	if (cpu->number >= trace->nr_cpus || !cpu_isset(cpu->number, trace->cpus))
+		return;
+
+	cpu->load = 0;
+	cpu->hardirq_load = 0;
+
+	cpu->hardirq_load = trace->cpu_irq_time[cpu->number];
+	cpu->load = cpu->hardirq_load;
+	for (group = 0; group < SOFTIRQ_GROUPS; group++) {
+		cpu->softirq_load[group] = trace->cpu_softirq_time[cpu->number * SOFTIRQ_GROUPS + group];
+		cpu->load += cpu->softirq_load[group];
+	}
+}
+
+/*
+ * Turn the time the cpu spent this interval into work at its top
+ * frequency, so that loads of cpus running at different speeds compare
+ */
+static void scale_cpu_load(struct topo_obj *cpu)
+{
+	int group;
+
+	cpu->load = freq_work(cpu, cpu->load);
+	cpu->hardirq_load = freq_work(cpu, cpu->hardirq_load);
+	for (group = 0; group < SOFTIRQ_GROUPS; group++)
+		cpu->softirq_load[group] = freq_work(cpu, cpu->softirq_load[group]);
+	cpu->app_load = freq_work(cpu, cpu->app_load);
+}
+
+/*
+ * Parse the next space separated decimal field of a /proc/stat line,
+ * NULL if the line has no more fields
+ */
+static char *scan_stat_field(char *c, unsigned long long *val)
+{
+	unsigned long long v = 0;
+
+	while (*c == ' ')
+		c++;
+	if (*c < '0' || *c > '9')
+		return NULL;
+	while (*c >= '0' && *c <= '9')
+		v = v * 10 + (*c++ - '0');
+
+	*val = v;
+	return c;
+}
+
+/* columns of a cpu line of /proc/stat, after the cpu number */
+enum stat_column {
+	STAT_USER,
+	STAT_NICE,
+	STAT_SYSTEM,
+	STAT_IDLE,
+	STAT_IOWAIT,
+	STAT_IRQ,
+	STAT_SOFTIRQ,
+	STAT_STEAL,
+	STAT_GUEST,
+	STAT_GUEST_NICE,
+	STAT_COLUMNS
+};
+
+/*
+ * Share of the last interval a cpu was available to run irqs, of
+ * CAPACITY_SCALE.  Time stolen by the hypervisor is gone from a vcpu, and
+ * on a host the time spent running guests is time their vcpus are
+ * preempted by every interrupt handled there.
+ */
+static void update_cpu_avail(struct topo_obj *cpu, unsigned long long *stat)
+{
+	uint64_t time = 0, stolen, avail;
+	int col;
+
+	/* guest time is already accounted as user time */
+	for (col = STAT_USER; col <= STAT_STEAL; col++)
+		time += stat[col];
+	stolen = stat[STAT_STEAL] + stat[STAT_GUEST] + stat[STAT_GUEST_NICE];
+	if (stat[STAT_STEAL])
+		steal_reported = 1;
+
+	if (cycle_count && time > cpu->last_stat_time)
+		stat_interval = MAX(stat_interval, (uint64_t)((time - cpu->last_stat_time) * NSEC_PER_SEC / HZ));
+
+	if (cycle_count && time > cpu->last_stat_time &&
+	    stolen >= cpu->last_stolen_time) {
+		avail = CAPACITY_SCALE - MIN(CAPACITY_SCALE,
+			(stolen - cpu->last_stolen_time) * CAPACITY_SCALE /
+			(time - cpu->last_stat_time));
+		/* steal comes in bursts, smooth it over a few intervals */
+		cpu->avail = (cpu->avail + avail) / 2;
+	}
+
+	cpu->last_stat_time = time;
+	cpu->last_stolen_time = stolen;
+}
+
+void parse_proc_stat(void)
+{
+	FILE *file;
+	char *line = NULL, *c;
+	size_t size = 0;
+	int cpunr, col, cpucount;
+	struct topo_obj *cpu;
+	unsigned long long stat[STAT_COLUMNS];
+	unsigned long long irq_load, softirq_load, app_load, val;
+	struct irqtrace_sample *trace = snapshot_irqtrace();
+
+	parse_proc_softirqs();
+	update_cpufreq();
+
+	file = open_proc_source(PROC_STAT);
 	if (!file) {
 		log(TO_ALL, LOG_WARNING, "WARNING cant open /proc/stat.  balancing is broken\n");
 		return;
@@ -488,21 +856,33 @@ void parse_proc_stat(void)
 	}
 
 	cpucount = 0;
+	stat_interval = 0;
 	while (!feof(file)) {
 		if (getline(&line, &size, file)<=0)
 			break;
 
-		if (!strstr(line, "cpu"))
+		if (strncmp(line, "cpu", 3))
 			break;
 
-		cpunr = strtoul(&line[3], NULL, 10);
+		c = scan_stat_field(&line[3], &val);
+		if (!c)
+			break;
+		cpunr = val;
 
 		if (cpu_isset(cpunr, banned_cpus))
 			continue;
 
-		rc = sscanf(line, "%*s %*u %*u %*u %*u %*u %llu %llu", &irq_load, &softirq_load);
-		if (rc < 2)
-			break;	
+		for (col = 0; c && col <= STAT_SOFTIRQ; col++)
+			c = scan_stat_field(c, &stat[col]);
+		if (!c)
+			break;
+		/* older kernels stop after softirq or steal */
+		for (; col < STAT_COLUMNS; col++)
+			if (!c || !(c = scan_stat_field(c, &stat[col])))
+				stat[col] = 0;
+		irq_load = stat[STAT_IRQ];
+		softirq_load = stat[STAT_SOFTIRQ];
+		app_load = stat[STAT_USER] + stat[STAT_NICE] + stat[STAT_SYSTEM] + stat[STAT_IOWAIT];
 
 		cpu = find_cpu_core(cpunr);
 
@@ -524,8 +904,18 @@ void parse_proc_stat(void)
 			 * interrupt.
 			 */
 			cpu->load *= NSEC_PER_SEC/HZ;
+			cpu->hardirq_load = 0;
+			split_softirq_load(cpu, (softirq_load - cpu->last_softirq_load) * NSEC_PER_SEC/HZ);
+			if (trace)
+				apply_irqtrace(cpu, trace);
+			cpu->app_load = (app_load >= cpu->last_app_load) ?
+				(app_load - cpu->last_app_load) * NSEC_PER_SEC/HZ : 0;
+			scale_cpu_load(cpu);
 		}
 		cpu->last_load = (irq_load + softirq_load);
+		cpu->last_app_load = app_load;
+		cpu->last_softirq_load = softirq_load;
+		update_cpu_avail(cpu, stat);
 	}
 
 	fclose(file);
@@ -535,16 +925,35 @@ void parse_proc_stat(void)
 		return;
 	}
 
+	distribute_load(trace);
+}
+
+/*
+ * Spread the load of the cpus over the objects above them and the irqs
+ * that caused it, once the load and the interrupt counts of the interval
+ * are in place
+ */
+void distribute_load(struct irqtrace_sample *trace)
+{
 	/*
  	 * Set the load values for all objects above cpus
  	 */
 	for_each_object(numa_nodes, set_load, NULL);
+	update_capacity();
+
+	/*
+	 * Learn from this interval what interrupts of each class cost
+	 * before weighing the irqs by it
+	 */
+	update_cost_model();
 
 	/*
  	 * Collect local irq_count on each object
  	 */
 	for_each_object(numa_nodes, accumulate_interrupts, NULL);
 
+	for_each_irq(NULL, set_handler_time, trace);
+
 	/*
  	 * Now that we have load for each cpu attribute a fair share of the load
  	 * to each irq on that cpu
@@ -553,5 +962,4 @@ void parse_proc_stat(void)
 	for_each_object(cache_domains, compute_irq_branch_load_share, NULL);
 	for_each_object(packages, compute_irq_branch_load_share, NULL);
 	for_each_object(numa_nodes, compute_irq_branch_load_share, NULL);
-
 }
@@ -0,0 +1,854 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains irqbalance-sim, which runs the balancing cycle of the
+ * daemon over a described machine and a recorded series of interrupt
+ * counts instead of the live system.  Nothing is read from sysfs or procfs
+ * and nothing is written, so the placements different options lead to can
+ * be compared offline and without root.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#include "irqbalance.h"
+
+/* ns an interrupt costs unless its declaration says otherwise */
+#define SIM_IRQ_COST	1000
+
+#define SIM_DELIM	" \t\n"
+
+#define OPT_DEDICATE	256
+#define OPT_SOLVER	257
+#define OPT_CONSOLIDATE	258
+#define OPT_WAKELATENCY	259
+#define OPT_STORM	260
+#define OPT_QUARANTINE	261
+#define OPT_SMTTHRESH	262
+
+/* the keys of a cpu line naming the domains it shares with other cpus */
+static const struct {
+	const char *key;
+	int level;
+	int cache_level;
+} domain_keys[] = {
+	/* in the order read_cpu_domains() finds them in sysfs */
+	{ "core",	BALANCE_SMT,	 0 },
+	{ "die",	BALANCE_DIE,	 0 },
+	{ "l1",		BALANCE_CACHE,	 1 },
+	{ "l2",		BALANCE_CACHE,	 2 },
+	{ "l3",		BALANCE_CACHE,	 3 },
+	{ "l4",		BALANCE_CACHE,	 4 },
+	{ "cluster",	BALANCE_CLUSTER, 0 },
+};
+#define NR_DOMAIN_KEYS	7
+
+struct sim_cpu {
+	int number;
+	int package;
+	int node;
+	int capacity;
+	int idle;
+	int wake_latency;
+	int steal;
+	int domain_id[NR_DOMAIN_KEYS];
+};
+
+struct sim_cgroup {
+	char *name;
+	cpumask_t cpus;
+};
+
+struct sim_node {
+	int number;
+	int nr_distances;
+	int *distances;
+};
+
+struct sim_irq {
+	struct irq_info *info;
+	uint64_t cost;
+	uint64_t count;
+};
+
+struct sim_charge {
+	cpumask_t mask;
+	uint64_t share;
+};
+
+struct sim_stats {
+	double sum;
+	double sum_sq;
+	double max;
+	int count;
+	int moved;
+	int powersave;
+};
+
+static GList *sim_cpus;
+static GList *sim_nodes;
+static GList *sim_cgroups;
+static GHashTable *sim_irqs;
+
+static const char *file_name;
+static int line_nr;
+
+#ifdef HAVE_GETOPT_LONG
+struct option lopts[] = {
+	{"debug", 0, NULL, 'd'},
+	{"interval", 1, NULL, 't'},
+	{"deepestcache", 1, NULL, 'c'},
+	{"migrateval", 1, NULL, 'e'},
+	{"powerthresh", 1, NULL, 'p'},
+	{"dedicate", 1, NULL, OPT_DEDICATE},
+	{"solver", 1, NULL, OPT_SOLVER},
+	{"consolidate", 1, NULL, OPT_CONSOLIDATE},
+	{"wakelatency", 1, NULL, OPT_WAKELATENCY},
+	{"storm", 1, NULL, OPT_STORM},
+	{"quarantine", 1, NULL, OPT_QUARANTINE},
+	{"smtthresh", 1, NULL, OPT_SMTTHRESH},
+	{"version", 0, NULL, 'V'},
+	{0, 0, 0, 0}
+};
+#endif
+
+static void usage(void)
+{
+	log(TO_CONSOLE, LOG_INFO, "irqbalance-sim [--debug | -d] [--interval= | -t <n>] [--deepestcache= | -c <n>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--migrateval= | -e <n>] [--powerthresh= | -p <off> | <n>] [--dedicate=<percent>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--solver=<greedy | global>[,<ms>]] [--consolidate=<cache | package>[,<percent>]]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--wakelatency=<us>] [--storm=<irqs per second>] [--quarantine=<cpulist>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	[--smtthresh=<irqs per second>]\n");
+	log(TO_CONSOLE, LOG_INFO, "	<topology> <trace>\n");
+}
+
+static void parse_error(const char *what, const char *token)
+{
+	fprintf(stderr, "%s:%d: %s: %s\n", file_name, line_nr, what, token);
+	exit(1);
+}
+
+/* split a key=value token, returning the value */
+static char *split_token(char *token, char **key)
+{
+	char *value;
+
+	value = strchr(token, '=');
+	if (!value || value == token || !value[1])
+		parse_error("expected key=value", token);
+	*value++ = '\0';
+	*key = token;
+	return value;
+}
+
+static long parse_number(char *value)
+{
+	char *end;
+	long val;
+
+	val = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || val < 0)
+		parse_error("bad number", value);
+	return val;
+}
+
+/* the next line with anything on it but comments, NULL at the end */
+static char *next_line(FILE *file, char **line, size_t *size)
+{
+	char *c;
+
+	while (getline(line, size, file) > 0) {
+		line_nr++;
+		c = strchr(*line, '#');
+		if (c)
+			*c = '\0';
+		c = *line + strspn(*line, SIM_DELIM);
+		if (*c)
+			return c;
+	}
+	return NULL;
+}
+
+static void parse_cpu_line(char *line)
+{
+	struct sim_cpu *cpu;
+	char *token, *key, *value, *save;
+	unsigned int i;
+
+	cpu = calloc(1, sizeof(struct sim_cpu));
+	if (!cpu)
+		exit(1);
+	cpu->number = -1;
+	cpu->node = NUMA_NO_NODE;
+	cpu->capacity = CAPACITY_SCALE;
+	for (i = 0; i < NR_DOMAIN_KEYS; i++)
+		cpu->domain_id[i] = -1;
+
+	for (token = strtok_r(line, SIM_DELIM, &save); token;
+	     token = strtok_r(NULL, SIM_DELIM, &save)) {
+		value = split_token(token, &key);
+		if (!strcmp(key, "cpu")) {
+			cpu->number = parse_number(value);
+		} else if (!strcmp(key, "package")) {
+			cpu->package = parse_number(value);
+		} else if (!strcmp(key, "node")) {
+			cpu->node = parse_number(value);
+		} else if (!strcmp(key, "capacity")) {
+			cpu->capacity = parse_number(value);
+			if (!cpu->capacity || cpu->capacity > CAPACITY_SCALE)
+				parse_error("bad capacity", value);
+		} else if (!strcmp(key, "idle")) {
+			cpu->idle = parse_number(value);
+			if (cpu->idle > 1000)
+				parse_error("bad idle residency", value);
+		} else if (!strcmp(key, "wake")) {
+			cpu->wake_latency = parse_number(value);
+		} else if (!strcmp(key, "steal")) {
+			cpu->steal = parse_number(value);
+			if (cpu->steal > 1000)
+				parse_error("bad steal time", value);
+		} else {
+			for (i = 0; i < NR_DOMAIN_KEYS; i++) {
+				if (!strcmp(key, domain_keys[i].key))
+					break;
+			}
+			if (i == NR_DOMAIN_KEYS)
+				parse_error("unknown key", key);
+			cpu->domain_id[i] = parse_number(value);
+		}
+	}
+
+	if (cpu->number >= NR_CPUS)
+		parse_error("bad cpu", "number too large");
+	sim_cpus = g_list_append(sim_cpus, cpu);
+}
+
+static void parse_node_line(char *line)
+{
+	struct sim_node *node;
+	char *token, *key, *value, *save, *d;
+
+	node = calloc(1, sizeof(struct sim_node));
+	if (!node)
+		exit(1);
+
+	for (token = strtok_r(line, SIM_DELIM, &save); token;
+	     token = strtok_r(NULL, SIM_DELIM, &save)) {
+		value = split_token(token, &key);
+		if (!strcmp(key, "node")) {
+			node->number = parse_number(value);
+		} else if (!strcmp(key, "distance")) {
+			for (d = strtok(value, ","); d; d = strtok(NULL, ",")) {
+				node->distances = realloc(node->distances,
+							  (node->nr_distances + 1) * sizeof(int));
+				if (!node->distances)
+					exit(1);
+				node->distances[node->nr_distances++] = parse_number(d);
+			}
+		} else {
+			parse_error("unknown key", key);
+		}
+	}
+
+	sim_nodes = g_list_append(sim_nodes, node);
+}
+
+static struct sim_cgroup *find_cgroup(const char *name)
+{
+	GList *entry;
+
+	for (entry = g_list_first(sim_cgroups); entry; entry = g_list_next(entry)) {
+		if (!strcmp(((struct sim_cgroup *)entry->data)->name, name))
+			return entry->data;
+	}
+	return NULL;
+}
+
+static void parse_cgroup_line(char *line)
+{
+	struct sim_cgroup *cgroup;
+	char *token, *key, *value, *save;
+
+	cgroup = calloc(1, sizeof(struct sim_cgroup));
+	if (!cgroup)
+		exit(1);
+
+	for (token = strtok_r(line, SIM_DELIM, &save); token;
+	     token = strtok_r(NULL, SIM_DELIM, &save)) {
+		value = split_token(token, &key);
+		if (!strcmp(key, "cgroup")) {
+			if (find_cgroup(value))
+				parse_error("cgroup described twice", value);
+			cgroup->name = strdup(value);
+		} else if (!strcmp(key, "cpus")) {
+			if (cpulist_parse(value, strlen(value), cgroup->cpus))
+				parse_error("bad cpu list", value);
+		} else {
+			parse_error("unknown key", key);
+		}
+	}
+
+	sim_cgroups = g_list_append(sim_cgroups, cgroup);
+}
+
+/*
+ * One line per cpu, naming its package, node and the ids of the domains
+ * it shares with other cpus of the package, e.g.
+ *	cpu=0 package=0 node=0 core=0 l2=0 l3=0
+ * optionally one line per node with its distances to the others, e.g.
+ *	node=0 distance=10,21
+ * and one line per cgroup irqs follow, with the cpus of its cpuset, e.g.
+ *	cgroup=web cpus=2-3
+ */
+static void read_topology(const char *path)
+{
+	FILE *file;
+	char *line = NULL, *c;
+	size_t size = 0;
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		exit(1);
+	}
+	file_name = path;
+	line_nr = 0;
+
+	while ((c = next_line(file, &line, &size))) {
+		if (g_str_has_prefix(c, "cpu="))
+			parse_cpu_line(c);
+		else if (g_str_has_prefix(c, "node="))
+			parse_node_line(c);
+		else if (g_str_has_prefix(c, "cgroup="))
+			parse_cgroup_line(c);
+		else
+			parse_error("expected a cpu, node or cgroup line", c);
+	}
+
+	free(line);
+	fclose(file);
+}
+
+static int same_domain(struct sim_cpu *a, struct sim_cpu *b, int key)
+{
+	if (a->package != b->package)
+		return 0;
+	return key < 0 || (a->domain_id[key] >= 0 && a->domain_id[key] == b->domain_id[key]);
+}
+
+static void add_sim_cpu(struct sim_cpu *cpu)
+{
+	struct cpu_desc desc;
+	struct sim_cpu *other;
+	struct cpu_domain *domain;
+	GList *entry;
+	unsigned int i;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.number = cpu->number;
+	desc.package = cpu->package;
+	desc.node = cpu->node;
+	desc.capacity = cpu->capacity;
+
+	for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry)) {
+		other = entry->data;
+		if (same_domain(cpu, other, -1))
+			cpu_set(other->number, desc.package_mask);
+	}
+
+	for (i = 0; i < NR_DOMAIN_KEYS; i++) {
+		if (cpu->domain_id[i] < 0)
+			continue;
+		domain = &desc.domains[desc.nr_domains++];
+		domain->level = domain_keys[i].level;
+		domain->cache_level = domain_keys[i].cache_level;
+		for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry)) {
+			other = entry->data;
+			if (same_domain(cpu, other, i))
+				cpu_set(other->number, domain->mask);
+		}
+	}
+
+	add_cpu_to_tree(&desc);
+}
+
+/* the idle states and the steal time don't change over the trace */
+static void set_sim_state(struct sim_cpu *cpu)
+{
+	struct topo_obj *obj = find_cpu_core(cpu->number);
+
+	if (!obj)
+		return;
+	obj->idle = cpu->idle;
+	obj->wake_latency = cpu->wake_latency;
+
+	/* as update_cpu_avail() finds it in /proc/stat */
+	obj->avail = CAPACITY_SCALE - cpu->steal * CAPACITY_SCALE / 1000;
+	if (cpu->steal)
+		steal_reported = 1;
+}
+
+/* the numa nodes first, then the cpus, as build_object_tree() does */
+static void build_sim_tree(void)
+{
+	struct sim_cpu *cpu;
+	struct sim_node *node;
+	cpumask_t mask;
+	GList *entry, *other;
+	int i;
+
+	cpus_clear(banned_cpus);
+	cpus_complement(unbanned_cpus, banned_cpus);
+
+	/* with a node given for any cpu, placement goes by node */
+	for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry)) {
+		if (((struct sim_cpu *)entry->data)->node != NUMA_NO_NODE)
+			numa_avail = 1;
+	}
+
+	cpus_setall(mask);
+	add_numa_node(NUMA_NO_NODE, mask);
+	for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry)) {
+		cpu = entry->data;
+		if (cpu->node == NUMA_NO_NODE || get_numa_node(cpu->node))
+			continue;
+
+		cpus_clear(mask);
+		for (other = g_list_first(sim_cpus); other; other = g_list_next(other)) {
+			if (((struct sim_cpu *)other->data)->node == cpu->node)
+				cpu_set(((struct sim_cpu *)other->data)->number, mask);
+		}
+		add_numa_node(cpu->node, mask);
+	}
+
+	reset_numa_node_distances();
+	for (entry = g_list_first(sim_nodes); entry; entry = g_list_next(entry)) {
+		node = entry->data;
+		for (i = 0; i < node->nr_distances; i++)
+			set_numa_node_distance(node->number, i, node->distances[i]);
+	}
+
+	for_each_object(numa_nodes, dump_numa_node_info, NULL);
+	for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry))
+		add_sim_cpu(entry->data);
+	finish_cpu_tree();
+	clear_slots();
+
+	for (entry = g_list_first(sim_cpus); entry; entry = g_list_next(entry))
+		set_sim_state(entry->data);
+	average_cpuidle();
+}
+
+static int find_class(const char *name)
+{
+	int class;
+
+	for (class = 0; classes[class]; class++) {
+		if (!strcmp(classes[class], name))
+			return class;
+	}
+	parse_error("unknown class", name);
+	return IRQ_OTHER;
+}
+
+/*
+ * irq=<n> [class=<name>] [node=<n>] [cost=<ns>] [device=<n>] [cgroup=<name>
+ * [cgroup_scope=<cpus | cache>]] declares an irq, with the class names of
+ * the policy script, the ns each interrupt costs, the device whose queues
+ * it is one of and the cgroup it follows as the policy script sets it
+ */
+static void declare_irq(char *line)
+{
+	struct sim_irq *irq;
+	char *token, *key, *value, *save;
+	int number = -1, class = IRQ_OTHER, node = NUMA_NO_NODE, device = 0;
+	int scope = COLOCATE_CPUS;
+	struct sim_cgroup *cgroup = NULL;
+	uint64_t cost = SIM_IRQ_COST;
+
+	for (token = strtok_r(line, SIM_DELIM, &save); token;
+	     token = strtok_r(NULL, SIM_DELIM, &save)) {
+		value = split_token(token, &key);
+		if (!strcmp(key, "irq")) {
+			number = parse_number(value);
+		} else if (!strcmp(key, "class")) {
+			class = find_class(value);
+		} else if (!strcmp(key, "node")) {
+			node = parse_number(value);
+		} else if (!strcmp(key, "cost")) {
+			cost = parse_number(value);
+		} else if (!strcmp(key, "device")) {
+			device = parse_number(value);
+		} else if (!strcmp(key, "cgroup")) {
+			cgroup = find_cgroup(value);
+			if (!cgroup)
+				parse_error("undescribed cgroup", value);
+		} else if (!strcmp(key, "cgroup_scope")) {
+			if (!strcmp(value, "cpus"))
+				scope = COLOCATE_CPUS;
+			else if (!strcmp(value, "cache"))
+				scope = COLOCATE_CACHE;
+			else
+				parse_error("bad cgroup scope", value);
+		} else {
+			parse_error("unknown key", key);
+		}
+	}
+
+	irq = calloc(1, sizeof(struct sim_irq));
+	if (!irq)
+		exit(1);
+	irq->info = add_irq_to_db(number, class, node);
+	if (!irq->info)
+		parse_error("irq declared twice", line);
+	irq->info->device = device;
+	if (cgroup) {
+		irq->info->cgroup = strdup(cgroup->name);
+		irq->info->cgroup_scope = scope;
+	}
+	irq->cost = cost;
+	g_hash_table_insert(sim_irqs, GINT_TO_POINTER(number), irq);
+
+	/* new irqs are placed on the next cycle, as after a hotplug */
+	force_rebalance_irq(irq->info, NULL);
+}
+
+static void read_counts(char *line)
+{
+	struct sim_irq *irq;
+	char *token, *key, *value, *save;
+
+	for (token = strtok_r(line, SIM_DELIM, &save); token;
+	     token = strtok_r(NULL, SIM_DELIM, &save)) {
+		value = split_token(token, &key);
+		irq = g_hash_table_lookup(sim_irqs, GINT_TO_POINTER(parse_number(key)));
+		if (!irq)
+			parse_error("undeclared irq", key);
+		irq->count = parse_number(value);
+	}
+}
+
+static void charge_cpu(struct topo_obj *cpu, void *data)
+{
+	struct sim_charge *charge = data;
+
+	if (cpu_isset(cpu->number, charge->mask))
+		cpu->load += charge->share;
+}
+
+/*
+ * Count the interrupts of the interval, and charge their cost to the cpus
+ * of the affinity they had during it, spread evenly
+ */
+static void handle_interrupts(gpointer key __attribute__((unused)), gpointer value,
+			      gpointer data __attribute__((unused)))
+{
+	struct sim_irq *irq = value;
+	struct irq_info *info = irq->info;
+	struct sim_charge charge;
+
+	info->last_irq_count = info->irq_count;
+	info->irq_count += irq->count;
+
+	if (info->assigned_obj)
+		applied_affinity(info, &charge.mask);
+	else
+		cpus_and(charge.mask, cpu_online_map, unbanned_cpus);
+	if (cpus_empty(charge.mask))
+		return;
+
+	charge.share = irq->count * irq->cost / cpus_weight(charge.mask);
+	for_each_object(cpus, charge_cpu, &charge);
+	irq->count = 0;
+}
+
+/* the cpusets don't change over the trace, but the cpus usable in them may */
+static void colocate_sim_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	if (info->cgroup)
+		colocate_irq(info, &find_cgroup(info->cgroup)->cpus);
+}
+
+static void clear_cpu_load(struct topo_obj *cpu, void *data __attribute__((unused)))
+{
+	cpu->load = 0;
+	cpu->hardirq_load = 0;
+	cpu->app_load = 0;
+	memset(cpu->softirq_load, 0, sizeof(cpu->softirq_load));
+}
+
+static void measure_cpu(struct topo_obj *cpu, void *data)
+{
+	struct sim_stats *stats = data;
+	double load = capacity_load(cpu, cpu->load);
+
+	stats->sum += load;
+	stats->sum_sq += load * load;
+	stats->max = MAX(stats->max, load);
+	stats->count++;
+	if (cpu->powersave_mode || cpu_isset(cpu->number, parked_cpus))
+		stats->powersave++;
+}
+
+/* report the affinity of each irq, as activate_mappings() would set it */
+static void report_irq(struct irq_info *info, void *data)
+{
+	struct sim_stats *stats = data;
+	char buf[PATH_MAX];
+	cpumask_t mask;
+
+	if (info->moved)
+		stats->moved++;
+	info->moved = 0;
+
+	if (!info->assigned_obj)
+		return;
+	applied_affinity(info, &mask);
+	cpumask_scnprintf(buf, PATH_MAX, mask);
+	printf("IRQ %d TYPE %d NUMBER %d LOAD %" PRIu64 " MASK %s\n", info->irq,
+	       info->assigned_obj->obj_type, info->assigned_obj->number, info->load, buf);
+}
+
+/*
+ * One interval of the trace, measured the way parse_proc_stat() does and
+ * balanced the way scan() does
+ */
+static void run_cycle(void)
+{
+	struct sim_stats stats;
+	double mean, var;
+
+	memset(&stats, 0, sizeof(stats));
+	for_each_object(cpus, clear_cpu_load, NULL);
+	stat_interval = (uint64_t)sleep_interval * NSEC_PER_SEC;
+	g_hash_table_foreach(sim_irqs, handle_interrupts, NULL);
+	distribute_load(NULL);
+
+	/* the load the cpus had with the placement of the last cycle */
+	for_each_object(cpus, measure_cpu, &stats);
+
+	/* no netdevs here, so no queue alignment */
+	for_each_irq(NULL, colocate_sim_irq, NULL);
+	update_quarantine();
+	update_dedicated_cpus();
+	update_consolidation();
+	if (cycle_count && solver_mode == SOLVER_GREEDY)
+		update_migration_status();
+	else if (solver_mode == SOLVER_GLOBAL)
+		solve_placement();
+	calculate_placement();
+
+	if (debug_mode)
+		dump_tree();
+
+	printf("CYCLE %llu\n", cycle_count);
+	for_each_irq(NULL, report_irq, &stats);
+
+	mean = stats.count ? stats.sum / stats.count : 0;
+	var = stats.count ? stats.sum_sq / stats.count - mean * mean : 0;
+	printf("MOVED %d POWERSAVE %d MAXLOAD %.0f IMBALANCE %.0f\n", stats.moved,
+	       stats.powersave, stats.max, var > 0 ? sqrt(var) : 0);
+
+	cycle_count++;
+}
+
+/*
+ * Declarations of irqs, and for every interval one line of
+ * <irq>=<interrupts> pairs; irqs that aren't listed had no interrupts
+ */
+static void run_trace(const char *path)
+{
+	FILE *file;
+	char *line = NULL, *c;
+	size_t size = 0;
+
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		exit(1);
+	}
+	file_name = path;
+	line_nr = 0;
+
+	while ((c = next_line(file, &line, &size))) {
+		if (g_str_has_prefix(c, "irq=")) {
+			declare_irq(c);
+		} else {
+			read_counts(c);
+			run_cycle();
+		}
+	}
+
+	free(line);
+	fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+	char *endptr = NULL;
+	int opt;
+
+	log_mask = TO_CONSOLE;
+	log_indent = "    ";
+
+	while ((opt = getopt_long(argc, argv, "dt:c:e:p:V", lopts, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			debug_mode = 1;
+			break;
+		case 't':
+			sleep_interval = strtol(optarg, &endptr, 10);
+			if (optarg == endptr || sleep_interval < 1) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'c':
+			deepest_cache = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr || deepest_cache == ULONG_MAX || deepest_cache < 1) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'e':
+			migrate_ratio = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'p':
+			if (g_str_has_prefix(optarg, "off"))
+				power_thresh = ULONG_MAX;
+			else {
+				power_thresh = strtoull(optarg, &endptr, 10);
+				if (optarg == endptr || power_thresh == ULONG_MAX) {
+					usage();
+					exit(1);
+				}
+			}
+			break;
+		case OPT_CONSOLIDATE:
+			if (g_str_has_prefix(optarg, "cache")) {
+				consolidate_mode = CONSOLIDATE_CACHE;
+				endptr = optarg + strlen("cache");
+			} else if (g_str_has_prefix(optarg, "package")) {
+				consolidate_mode = CONSOLIDATE_PACKAGE;
+				endptr = optarg + strlen("package");
+			} else {
+				usage();
+				exit(1);
+			}
+			if (*endptr == ',')
+				consolidate_threshold = strtoul(endptr + 1, &endptr, 10);
+			if (*endptr != '\0' || !consolidate_threshold || consolidate_threshold > 100) {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_WAKELATENCY:
+			wake_latency_threshold = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr || *endptr != '\0') {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_STORM:
+			storm_threshold = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr || *endptr != '\0') {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_QUARANTINE:
+			if (cpulist_parse(optarg, strlen(optarg), storm_cpus) || cpus_empty(storm_cpus)) {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_SMTTHRESH:
+			smt_threshold = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr || *endptr != '\0') {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_DEDICATE:
+			dedicate_threshold = strtoul(optarg, &endptr, 10);
+			if (optarg == endptr || *endptr != '\0' || dedicate_threshold > 100) {
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_SOLVER:
+			if (g_str_has_prefix(optarg, "greedy")) {
+				solver_mode = SOLVER_GREEDY;
+				endptr = optarg + strlen("greedy");
+			} else if (g_str_has_prefix(optarg, "global")) {
+				solver_mode = SOLVER_GLOBAL;
+				endptr = optarg + strlen("global");
+			} else {
+				usage();
+				exit(1);
+			}
+			if (*endptr == ',')
+				solver_budget = strtoul(endptr + 1, &endptr, 10);
+			if (*endptr != '\0' || !solver_budget || solver_budget > 1000) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'V':
+			log(TO_CONSOLE, LOG_INFO, "irqbalance-sim version " VERSION "\n");
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		exit(1);
+	}
+
+	/* only the report goes to stdout, unless debugging */
+	if (!debug_mode)
+		log_mask = 0;
+
+	read_topology(argv[optind]);
+	build_sim_tree();
+
+	sim_irqs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+	run_trace(argv[optind + 1]);
+
+	g_hash_table_destroy(sim_irqs);
+	free_irq_db();
+	clear_cpu_tree();
+	free_numa_node_list();
+	return 0;
+}
@@ -0,0 +1,502 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the global placement solver.  Instead of descending
+ * the topology one irq at a time, it assigns all movable irqs at once:
+ * heaviest first onto the object that adds the least cost (LPT), then
+ * improves on that by moving single irqs for as long as the time budget
+ * allows.
+ *
+ * The cost of an assignment is the sum of the squared capacity scaled
+ * loads of all cpus, plus the same for the average load of every last
+ * level cache, so that both cpus and caches are kept even.  Irqs placed
+ * on an object spread their load evenly over its cpus.  Placing an irq
+ * on a remote node and moving it at all are charged as if its load was
+ * put on a cpu that much busier than average.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "irqbalance.h"
+
+/* a move has to beat the current spot by 1/8th of the average cpu load */
+#define MIGRATION_HYSTERESIS	8
+
+int solver_mode = SOLVER_GREEDY;
+unsigned long solver_budget = 20;
+
+struct solver_cpu {
+	struct topo_obj *obj;
+	double load;		/* capacity scaled, of everything but the irqs */
+	double scale;		/* CAPACITY_SCALE / capacity */
+	int llc;		/* index of its last level cache, or -1 */
+};
+
+struct solver_llc {
+	double load;
+	int ncpus;
+};
+
+struct solver_obj {
+	struct topo_obj *obj;
+	int node;
+	int ncpus;
+	int *cpus;		/* usable cpus, indices into the cpu array */
+	int end;		/* index past its subtree */
+	int nirqs;		/* irqs the solver put on it */
+};
+
+struct solver_irq {
+	struct irq_info *info;
+	double load;
+	int ncands;
+	int *cands;		/* objects it may be placed on */
+	int orig;		/* where it is now, -1 if unplaced */
+	int cur;
+};
+
+struct solver {
+	int ncpus, nllcs, nobjs, nirqs;
+	struct solver_cpu *cpus;
+	struct solver_llc *llcs;
+	struct solver_obj *objs;
+	struct solver_irq *irqs;
+	GHashTable *obj_index;
+	double avg_load;
+	struct timespec deadline;
+};
+
+static int past_deadline(struct solver *s)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > s->deadline.tv_sec ||
+	       (now.tv_sec == s->deadline.tv_sec && now.tv_nsec >= s->deadline.tv_nsec);
+}
+
+static void add_cpu(struct topo_obj *d, void *data)
+{
+	struct solver *s = data;
+	struct solver_cpu *cpu = &s->cpus[s->ncpus];
+	struct topo_obj *obj;
+
+	cpu->obj = d;
+	cpu->load = capacity_load(d, obj_cost(d));
+	cpu->scale = d->capacity ? (double)CAPACITY_SCALE / d->capacity : 1;
+	cpu->llc = -1;
+	for (obj = d->parent; obj && obj->obj_type == OBJ_TYPE_CACHE; obj = obj->parent) {
+		if (obj->level == BALANCE_CACHE)
+			cpu->llc = GPOINTER_TO_INT(g_hash_table_lookup(s->obj_index, obj)) - 1;
+	}
+	if (cpu->llc >= 0) {
+		s->llcs[cpu->llc].ncpus++;
+		s->llcs[cpu->llc].load += cpu->load;
+	}
+	g_hash_table_insert(s->obj_index, d, GINT_TO_POINTER(s->ncpus + 1));
+	s->ncpus++;
+}
+
+static void number_llc(struct topo_obj *d, void *data)
+{
+	struct solver *s = data;
+
+	if (d->level == BALANCE_CACHE)
+		g_hash_table_insert(s->obj_index, d, GINT_TO_POINTER(++s->nllcs));
+}
+
+/*
+ * Every object irqs can be placed on, with the cpus they would use.  The
+ * objects are listed depth first, each followed by its subtree.
+ */
+static void add_object(struct topo_obj *d, struct solver *s, int node)
+{
+	struct solver_obj *o;
+	GList *entry;
+	int i, idx;
+
+	if (numa_avail && d->obj_type == OBJ_TYPE_NODE && d->number == NUMA_NO_NODE)
+		return;
+
+	/* objects shared by several nodes are listed under the first one */
+	if (g_hash_table_lookup(s->obj_index, d))
+		return;
+
+	if (d->obj_type == OBJ_TYPE_NODE)
+		node = d->number;
+
+	s->objs = realloc(s->objs, (s->nobjs + 1) * sizeof(*s->objs));
+	idx = s->nobjs++;
+	g_hash_table_insert(s->obj_index, d, GINT_TO_POINTER(idx + 1));
+	o = &s->objs[idx];
+	o->obj = d;
+	o->node = node;
+	o->ncpus = 0;
+	o->nirqs = 0;
+	o->cpus = malloc(s->ncpus * sizeof(int));
+	for (i = 0; i < s->ncpus; i++) {
+		if (cpu_isset(s->cpus[i].obj->number, d->mask) &&
+		    !cpu_isset(s->cpus[i].obj->number, dedicated_cpus) &&
+		    !cpu_isset(s->cpus[i].obj->number, parked_cpus) &&
+		    !cpu_isset(s->cpus[i].obj->number, quarantined_cpus))
+			o->cpus[o->ncpus++] = i;
+	}
+
+	for (entry = g_list_first(d->children); entry; entry = g_list_next(entry))
+		add_object(entry->data, s, node);
+	s->objs[idx].end = s->nobjs;
+}
+
+/*
+ * The objects an irq may end up on, the same the greedy descent would
+ * stop at: the first at or below the irq's balance level, deeper only to
+ * stay within its cgroup or hint.  With awake set, only objects whose cpus
+ * don't sleep count.
+ */
+static void find_candidates(struct solver *s, struct solver_irq *irq, int awake)
+{
+	struct irq_info *info = irq->info;
+	struct solver_obj *o;
+	int i = 0;
+
+	while (i < s->nobjs) {
+		o = &s->objs[i];
+		if (!o->ncpus || o->obj->powersave_mode || o->obj->slots_left <= 0 ||
+		    misses_colocation(info, o->obj) || (awake && obj_is_asleep(o->obj))) {
+			i = o->end;
+			continue;
+		}
+
+		if (o->obj->obj_type == OBJ_TYPE_CPU ||
+		    (o->obj->level >= info->level && !outside_colocation(info, o->obj))) {
+			irq->cands[irq->ncands++] = i;
+			i = o->end;
+			continue;
+		}
+
+		/* its children follow it */
+		i++;
+	}
+}
+
+static void add_load(struct solver *s, int obj, double load, int sign)
+{
+	struct solver_obj *o = &s->objs[obj];
+	struct solver_cpu *cpu;
+	double share = load / o->ncpus;
+	int i;
+
+	for (i = 0; i < o->ncpus; i++) {
+		cpu = &s->cpus[o->cpus[i]];
+		cpu->load += sign * share * cpu->scale;
+		if (cpu->llc >= 0)
+			s->llcs[cpu->llc].load += sign * share * cpu->scale;
+	}
+}
+
+/* what placing the irq on the object adds to the total cost */
+static double placement_cost(struct solver *s, struct solver_irq *irq, int obj)
+{
+	struct solver_obj *o = &s->objs[obj];
+	struct solver_cpu *cpu;
+	double share = irq->load / o->ncpus;
+	double cost = 0, add;
+	int i, node, distance;
+
+	for (i = 0; i < o->ncpus; i++) {
+		cpu = &s->cpus[o->cpus[i]];
+		add = share * cpu->scale;
+		cost += add * (2 * cpu->load + add);
+		if (cpu->llc >= 0)
+			cost += add * (2 * s->llcs[cpu->llc].load + add) /
+				s->llcs[cpu->llc].ncpus;
+	}
+
+	node = irq_numa_node(irq->info)->number;
+	distance = numa_node_distance(node, o->node);
+	if (distance > NUMA_LOCAL_DISTANCE)
+		cost += 2 * irq->load * s->avg_load * (distance - NUMA_LOCAL_DISTANCE) /
+			NUMA_LOCAL_DISTANCE;
+
+	if (obj != irq->orig)
+		cost += 2 * irq->load * s->avg_load / MIGRATION_HYSTERESIS;
+
+	return cost;
+}
+
+/* sum of the squared loads the cost is relative to */
+static double total_cost(struct solver *s)
+{
+	double cost = 0;
+	int i;
+
+	for (i = 0; i < s->ncpus; i++)
+		cost += s->cpus[i].load * s->cpus[i].load;
+	for (i = 0; i < s->nllcs; i++)
+		if (s->llcs[i].ncpus)
+			cost += s->llcs[i].load * s->llcs[i].load / s->llcs[i].ncpus;
+	return cost;
+}
+
+static double max_cpu_load(struct solver *s)
+{
+	double max = 0;
+	int i;
+
+	for (i = 0; i < s->ncpus; i++)
+		max = MAX(max, s->cpus[i].load);
+	return max;
+}
+
+static void add_irq(struct irq_info *info, void *data)
+{
+	struct solver *s = data;
+	struct solver_irq *irq;
+	gpointer idx = NULL;
+
+	/* irqs that don't want to move, heavy hitters on their own cpu and storms */
+	if (info->level == BALANCE_NONE || (info->flags & (IRQ_FLAG_DEDICATED | IRQ_FLAG_STORM)))
+		return;
+
+	s->irqs = realloc(s->irqs, (s->nirqs + 1) * sizeof(*s->irqs));
+	irq = &s->irqs[s->nirqs];
+	irq->info = info;
+	irq->load = info->load;
+	irq->ncands = 0;
+	irq->cands = malloc(s->nobjs * sizeof(int));
+	/* latency sensitive irqs go to sleeping cpus only if all of them sleep */
+	if (irq_is_latency_sensitive(info))
+		find_candidates(s, irq, 1);
+	if (!irq->ncands)
+		find_candidates(s, irq, 0);
+	if (!irq->ncands) {
+		free(irq->cands);
+		return;
+	}
+
+	irq->orig = -1;
+	if (info->assigned_obj)
+		idx = g_hash_table_lookup(s->obj_index, info->assigned_obj);
+	if (idx) {
+		int i;
+
+		/* only a spot among its candidates counts as where it is */
+		for (i = 0; i < irq->ncands; i++)
+			if (irq->cands[i] == GPOINTER_TO_INT(idx) - 1)
+				irq->orig = irq->cands[i];
+	}
+	irq->cur = irq->orig;
+	s->nirqs++;
+}
+
+static int compare_irq_load(const void *a, const void *b)
+{
+	const struct solver_irq *ia = a, *ib = b;
+
+	return (ia->load < ib->load) - (ia->load > ib->load);
+}
+
+/* the cheapest spot, on a tie the one with the fewest irqs, as the greedy descent does */
+static int best_candidate(struct solver *s, struct solver_irq *irq)
+{
+	double cost, best_cost = 0;
+	int i, best = -1;
+
+	for (i = 0; i < irq->ncands; i++) {
+		cost = placement_cost(s, irq, irq->cands[i]);
+		if (best < 0 || cost < best_cost ||
+		    (cost == best_cost && s->objs[irq->cands[i]].nirqs < s->objs[best].nirqs)) {
+			best = irq->cands[i];
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+static void free_solver(struct solver *s)
+{
+	int i;
+
+	for (i = 0; i < s->nobjs; i++)
+		free(s->objs[i].cpus);
+	for (i = 0; i < s->nirqs; i++)
+		free(s->irqs[i].cands);
+	free(s->objs);
+	free(s->irqs);
+	free(s->cpus);
+	free(s->llcs);
+	if (s->obj_index)
+		g_hash_table_destroy(s->obj_index);
+}
+
+static void build_solver(struct solver *s)
+{
+	int ncpus = g_list_length(cpus);
+	GList *entry;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->obj_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for_each_object(cache_domains, number_llc, s);
+	s->llcs = calloc(s->nllcs + 1, sizeof(*s->llcs));
+	s->cpus = calloc(ncpus + 1, sizeof(*s->cpus));
+	for_each_object(cpus, add_cpu, s);
+
+	/* the indices of the cpus and caches are no longer needed */
+	g_hash_table_remove_all(s->obj_index);
+	for (entry = g_list_first(numa_nodes); entry; entry = g_list_next(entry))
+		add_object(entry->data, s, NUMA_NO_NODE);
+
+	/* the placed irqs and those waiting for placement alike */
+	for (i = 0; i < s->nobjs; i++)
+		if (s->objs[i].obj->interrupts)
+			for_each_irq(s->objs[i].obj->interrupts, add_irq, s);
+	if (rebalance_irq_list)
+		for_each_irq(rebalance_irq_list, add_irq, s);
+}
+
+/*
+ * Take the movable irqs' load off the cpus, to get what the cpus carry
+ * besides them
+ */
+static void unload_irqs(struct solver *s)
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < s->nirqs; i++)
+		if (s->irqs[i].orig >= 0)
+			add_load(s, s->irqs[i].orig, s->irqs[i].load, -1);
+
+	for (i = 0; i < s->ncpus; i++) {
+		s->cpus[i].load = MAX(s->cpus[i].load, 0);
+		total += s->cpus[i].load;
+	}
+	for (i = 0; i < s->nllcs; i++)
+		s->llcs[i].load = 0;
+	for (i = 0; i < s->ncpus; i++)
+		if (s->cpus[i].llc >= 0)
+			s->llcs[s->cpus[i].llc].load += s->cpus[i].load;
+	for (i = 0; i < s->nirqs; i++)
+		total += s->irqs[i].load;
+
+	s->avg_load = s->ncpus ? total / s->ncpus : 0;
+}
+
+/*
+ * Place all movable irqs at once.  Irqs the solver has no spot for are
+ * left to the greedy placement.
+ */
+void solve_placement(void)
+{
+	struct solver s;
+	struct solver_irq *irq;
+	double before_cost, before_max, cost, best_cost;
+	int i, c, best, moves = 0, improved, passes = 0;
+	struct timespec start, end;
+
+	/* no loads to weigh before the first interval, the greedy descent places the irqs */
+	if (!cycle_count)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	build_solver(&s);
+
+	s.deadline = start;
+	s.deadline.tv_sec += solver_budget / 1000;
+	s.deadline.tv_nsec += (solver_budget % 1000) * 1000000;
+	if (s.deadline.tv_nsec >= 1000000000) {
+		s.deadline.tv_sec++;
+		s.deadline.tv_nsec -= 1000000000;
+	}
+
+	if (!s.nirqs || !s.ncpus) {
+		free_solver(&s);
+		return;
+	}
+
+	unload_irqs(&s);
+
+	/* the placement as it stands, to report what the solver gained */
+	for (i = 0; i < s.nirqs; i++)
+		if (s.irqs[i].orig >= 0)
+			add_load(&s, s.irqs[i].orig, s.irqs[i].load, 1);
+	before_cost = total_cost(&s);
+	before_max = max_cpu_load(&s);
+	for (i = 0; i < s.nirqs; i++)
+		if (s.irqs[i].orig >= 0)
+			add_load(&s, s.irqs[i].orig, s.irqs[i].load, -1);
+
+	/* longest processing time first */
+	qsort(s.irqs, s.nirqs, sizeof(*s.irqs), compare_irq_load);
+	for (i = 0; i < s.nirqs; i++) {
+		irq = &s.irqs[i];
+		irq->cur = best_candidate(&s, irq);
+		add_load(&s, irq->cur, irq->load, 1);
+		s.objs[irq->cur].nirqs++;
+	}
+
+	/* then move single irqs for as long as that helps and time allows */
+	do {
+		improved = 0;
+		passes++;
+		for (i = 0; i < s.nirqs && !past_deadline(&s); i++) {
+			irq = &s.irqs[i];
+			if (irq->ncands < 2)
+				continue;
+			add_load(&s, irq->cur, irq->load, -1);
+			s.objs[irq->cur].nirqs--;
+			best = irq->cur;
+			best_cost = placement_cost(&s, irq, irq->cur);
+			for (c = 0; c < irq->ncands; c++) {
+				cost = placement_cost(&s, irq, irq->cands[c]);
+				if (cost < best_cost) {
+					best = irq->cands[c];
+					best_cost = cost;
+				}
+			}
+			if (best != irq->cur)
+				improved = 1;
+			irq->cur = best;
+			add_load(&s, irq->cur, irq->load, 1);
+			s.objs[irq->cur].nirqs++;
+		}
+	} while (improved && !past_deadline(&s));
+
+	for (i = 0; i < s.nirqs; i++) {
+		irq = &s.irqs[i];
+		if (irq->cur == irq->orig)
+			continue;
+		migrate_irq_obj(NULL, s.objs[irq->cur].obj, irq->info);
+		moves++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	log(TO_CONSOLE, LOG_INFO,
+	    "solver: %d irqs, cost %.4g -> %.4g, max cpu load %.4g -> %.4g, %d moved, %d passes in %ld us\n",
+	    s.nirqs, before_cost, total_cost(&s), before_max, max_cpu_load(&s), moves, passes,
+	    (long)((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000));
+
+	free_solver(&s);
+}
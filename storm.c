@@ -0,0 +1,249 @@
+/*
+ * This file is part of irqbalance
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file contains the storm quarantine.  A misbehaving device may fire
+ * interrupts at a rate no balancing can absorb, and moving it around only
+ * spreads the damage to every cpu it visits and to the irqs it meets
+ * there.  An irq found storming is pinned to a set of quarantine cpus
+ * that no other irq is placed on, and whose load the balancing ignores,
+ * until the irq has calmed down again.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "irqbalance.h"
+
+/* interrupts per second that make a storm, 0 is off */
+unsigned long storm_threshold = 0;
+
+/* cpus storming irqs are confined to, empty for the last usable cpu */
+cpumask_t storm_cpus;
+
+/* cpus currently holding storming irqs, empty while there are none */
+cpumask_t quarantined_cpus;
+
+/* a rate this many times the recent one is the onset of a storm */
+#define STORM_RISE	4
+/* intervals a rate over the threshold has to last without such an onset */
+#define STORM_SUSTAIN	3
+/* intervals below half the threshold before a storm is over */
+#define STORM_CALM	3
+
+/*
+ * Judge the interrupt rate of the interval that just ended.  An irq is
+ * quarantined at once when its rate jumps over the threshold, and after a
+ * few intervals when it climbed there gradually.  Called for every irq
+ * once /proc/stat measured how long the interval was.
+ */
+static void check_irq_storm(struct irq_info *info, void *data __attribute__((unused)))
+{
+	uint64_t rate, recent;
+
+	/* irqs that aren't balanced can't be quarantined either */
+	if (!storm_threshold || info->level == BALANCE_NONE)
+		return;
+
+	/* the counts since boot of a new irq or tree are no rate */
+	if (!stat_interval || !cycle_count || !info->last_irq_count)
+		return;
+
+	rate = (info->irq_count - info->last_irq_count) * NSEC_PER_SEC / stat_interval;
+	recent = info->irq_rate;
+	info->irq_rate = (info->irq_rate + rate) / 2;
+
+	if (info->flags & IRQ_FLAG_STORM) {
+		/* some hysteresis, so that irqs around the threshold don't flap */
+		if (rate >= storm_threshold / 2) {
+			info->storm_count = 0;
+			return;
+		}
+		if (++info->storm_count < STORM_CALM)
+			return;
+
+		log(TO_ALL, LOG_WARNING, "IRQ %d calmed down to %" PRIu64 " interrupts/s, releasing it from quarantine\n",
+		    info->irq, rate);
+		info->flags &= ~IRQ_FLAG_STORM;
+		info->storm_count = 0;
+		force_rebalance_irq(info, NULL);
+		return;
+	}
+
+	if (rate < storm_threshold) {
+		info->storm_count = 0;
+		return;
+	}
+	if (rate < recent * STORM_RISE && ++info->storm_count < STORM_SUSTAIN)
+		return;
+
+	log(TO_ALL, LOG_WARNING, "IRQ %d storming at %" PRIu64 " interrupts/s, quarantining it\n",
+	    info->irq, rate);
+	info->flags |= IRQ_FLAG_STORM;
+	info->storm_count = 0;
+}
+
+/* the configured quarantine cpus that are usable, else the last usable cpu */
+static void get_quarantine_cpus(cpumask_t *mask)
+{
+	int cpu;
+
+	cpus_and(*mask, storm_cpus, unbanned_cpus);
+	cpus_and(*mask, *mask, cpu_online_map);
+	if (!cpus_empty(*mask))
+		return;
+
+	for (cpu = NR_CPUS - 1; cpu >= 0; cpu--) {
+		if (cpu_isset(cpu, unbanned_cpus) && cpu_isset(cpu, cpu_online_map) &&
+		    find_cpu_core(cpu)) {
+			cpu_set(cpu, *mask);
+			return;
+		}
+	}
+}
+
+static void collect_storm(struct irq_info *info, void *data)
+{
+	GList **storms = data;
+
+	if (info->level != BALANCE_NONE && (info->flags & IRQ_FLAG_STORM))
+		*storms = g_list_append(*storms, info);
+}
+
+/* the quarantine cpu with the fewest storming irqs so far */
+static void find_quarantine_cpu(struct topo_obj *cpu, void *data)
+{
+	struct topo_obj **best = data;
+
+	if (!cpu_isset(cpu->number, quarantined_cpus))
+		return;
+	if (!*best || g_list_length(cpu->interrupts) < g_list_length((*best)->interrupts))
+		*best = cpu;
+}
+
+static void evict_irq(struct irq_info *info, void *data __attribute__((unused)))
+{
+	if (!(info->flags & IRQ_FLAG_STORM))
+		force_rebalance_irq(info, NULL);
+}
+
+static void evict_quarantine_cpu(struct topo_obj *cpu, void *data __attribute__((unused)))
+{
+	if (cpu_isset(cpu->number, quarantined_cpus) && cpu->interrupts)
+		for_each_irq(cpu->interrupts, evict_irq, NULL);
+}
+
+static void quarantine_irq(gpointer data, gpointer user_data __attribute__((unused)))
+{
+	struct irq_info *info = data;
+	struct topo_obj *cpu = info->assigned_obj;
+
+	if (cpu && cpu->obj_type == OBJ_TYPE_CPU && cpu_isset(cpu->number, quarantined_cpus))
+		return;
+
+	/* a heavy hitter gives up its cpu, it is taken care of here now */
+	info->flags &= ~IRQ_FLAG_DEDICATED;
+
+	cpu = NULL;
+	for_each_object(cpus, find_quarantine_cpu, &cpu);
+	if (cpu)
+		migrate_irq_obj(NULL, cpu, info);
+}
+
+/*
+ * irqs balanced over cpus that were just quarantined or given back need
+ * their affinity rewritten, even if they stay where they are
+ */
+static void refresh_affinity(struct irq_info *info, void *data)
+{
+	cpumask_t *changed = data;
+
+	if (info->assigned_obj && !(info->flags & IRQ_FLAG_STORM) &&
+	    cpus_intersects(info->assigned_obj->mask, *changed))
+		info->moved = 1;
+}
+
+/*
+ * Find the irqs storming in the interval, pin them to the quarantine cpus,
+ * and move the other irqs off them.  The cpus return to the pool once no
+ * irq storms any more.  Called every interval after /proc/stat is parsed,
+ * before the heavy hitters get their cpus.
+ */
+void update_quarantine(void)
+{
+	cpumask_t old, changed;
+	GList *storms = NULL;
+
+	if (!storm_threshold)
+		return;
+
+	cpus_copy(old, quarantined_cpus);
+	cpus_clear(quarantined_cpus);
+
+	for_each_irq(NULL, check_irq_storm, NULL);
+	for_each_irq(NULL, collect_storm, &storms);
+	if (storms) {
+		get_quarantine_cpus(&quarantined_cpus);
+		for_each_object(cpus, evict_quarantine_cpu, NULL);
+		g_list_foreach(storms, quarantine_irq, NULL);
+		g_list_free(storms);
+	}
+
+	cpus_xor(changed, old, quarantined_cpus);
+	if (!cpus_empty(changed)) {
+		char buf[PATH_MAX];
+
+		cpumask_scnprintf(buf, PATH_MAX, quarantined_cpus);
+		log(TO_CONSOLE, LOG_INFO, "Quarantine cpus now %s\n", buf);
+		for_each_irq(NULL, refresh_affinity, &changed);
+	}
+}
+
+static void add_storm_stat(struct irq_info *info, void *data)
+{
+	char **stat = data;
+	char *newstat;
+
+	if (!(info->flags & IRQ_FLAG_STORM))
+		return;
+
+	newstat = g_strdup_printf("%s IRQ %d RATE %" PRIu64, *stat, info->irq, info->irq_rate);
+	g_free(*stat);
+	*stat = newstat;
+}
+
+/*
+ * Format the quarantine for the socket API, the cpus and the storming
+ * irqs with their recent rate, NULL if storm detection is off
+ */
+char *get_storm_stat(void)
+{
+	char buf[PATH_MAX];
+	char *stat;
+
+	if (!storm_threshold)
+		return NULL;
+
+	cpumask_scnprintf(buf, PATH_MAX, quarantined_cpus);
+	stat = g_strdup_printf("THRESHOLD %lu CPUS %s", storm_threshold, buf);
+	for_each_irq(NULL, add_storm_stat, &stat);
+	return stat;
+}
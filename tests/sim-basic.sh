@@ -0,0 +1,19 @@
+#!/bin/sh
+# The simulator reports every interval of a trace and places every irq,
+# and refuses traces it can't make sense of.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 "$data/two-packages.topo" "$data/basic.trace"
+
+[ "$(cycles)" -eq 4 ] || fail "$(cycles) cycles reported for 4 intervals"
+for irq in 30 31 40 1; do
+	[ -n "$(irq_mask 3 $irq)" ] || fail "irq $irq not placed"
+done
+
+printf 'irq=30\n31=100\n' > "$out.trace"
+if "$SIM" "$data/two-packages.topo" "$out.trace" > /dev/null 2>&1; then
+	rm -f "$out.trace"
+	fail "undeclared irq accepted"
+fi
+rm -f "$out.trace"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Cpus of half the capacity get half the work of the others.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 "$data/two-packages.topo" "$data/capacity.trace"
+
+last=$(( $(cycles) - 1 ))
+fast=0
+slow=0
+irq=60
+while [ $irq -le 71 ]; do
+	if masks_overlap "$(irq_mask $last $irq)" 0f; then
+		fast=$((fast + 1))
+	else
+		slow=$((slow + 1))
+	fi
+	irq=$((irq + 1))
+done
+[ $fast -eq $((slow * 2)) ] || fail "$fast irqs on the full and $slow on the half capacity cpus"
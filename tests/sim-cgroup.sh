@@ -0,0 +1,27 @@
+#!/bin/sh
+# Irqs following a cgroup stay on its cpus, or with the cache scope on the
+# last level cache they are in, even when cpus elsewhere are idle.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 "$data/two-caches.topo" "$data/cgroup.trace"
+
+last=$(( $(cycles) - 1 ))
+cycle=0
+while [ $cycle -le $last ]; do
+	for irq in 20 60; do
+		mask=$(irq_mask $cycle $irq)
+		[ $(( 0x$mask & ~0x0c )) -eq 0 ] || fail "irq $irq left the cgroup for $mask"
+	done
+	mask=$(irq_mask $cycle 61)
+	[ $(( 0x$mask & ~0x0f )) -eq 0 ] || fail "irq 61 left the cache of the cgroup for $mask"
+	cycle=$((cycle + 1))
+done
+
+# the cpus of the cgroup are busy, the rest of the cache isn't
+masks_overlap "$(irq_mask $last 61)" 03 || fail "irq 61 kept to the cpus of the cgroup"
+
+# without a cache domain in the tree, the cache scope widens to the package
+run_sim -t 1 "$data/no-cache.topo" "$data/cgroup.trace"
+last=$(( $(cycles) - 1 ))
+masks_overlap "$(irq_mask $last 61)" 03 || fail "irq 61 kept to the cpus of the cgroup without a cache"
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Consolidation parks whole last level caches or packages, and keeps the
+# same ones parked while the load stays low, even as the irqs of one
+# node or the other are the heavier.
+
+. "${srcdir:-.}/simlib.sh"
+
+# check_parked <first cycle> <parked cpus>: settled from that cycle on
+check_parked() {
+	cycle=$1
+	while [ $cycle -lt $(cycles) ]; do
+		[ "$(cycle_stat $cycle POWERSAVE)" -eq $2 ] ||
+			fail "$(cycle_stat $cycle POWERSAVE) cpus parked in cycle $cycle, not $2"
+		[ "$(cycle_stat $cycle MOVED)" -eq 0 ] ||
+			fail "$(cycle_stat $cycle MOVED) irqs moved in cycle $cycle"
+		cycle=$((cycle + 1))
+	done
+}
+
+run_sim -t 1 --consolidate=package "$data/two-packages.topo" "$data/consolidate.trace"
+check_parked 4 4
+
+# the last level caches are in the tree whatever the deepest cache level
+run_sim -t 1 -c 1 --consolidate=cache "$data/two-caches.topo" "$data/consolidate.trace"
+check_parked 4 4
+
+run_sim -t 1 --consolidate=cache "$data/two-caches.topo" "$data/consolidate.trace"
+check_parked 4 4
+last=$(( $(cycles) - 1 ))
+for cache in 0f f0; do
+	for irq in 30 31 32 33; do
+		masks_overlap "$(irq_mask $last $irq)" $cache || continue 2
+	done
+	exit 0
+done
+fail "irqs not consolidated onto one cache"
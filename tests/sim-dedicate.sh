@@ -0,0 +1,24 @@
+#!/bin/sh
+# A heavy hitter gets a cpu that no other irq is balanced over, and the
+# cpu goes back to the other irqs once the heavy hitter calms down.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 --dedicate=50 "$data/two-cores.topo" "$data/dedicate.trace"
+
+# the last interval the heavy hitter is busy
+own=$(irq_mask 5 30)
+for irq in 31 32 1 2; do
+	if masks_overlap "$(irq_mask 5 $irq)" "$own"; then
+		fail "irq $irq shares the cpus $own of the heavy hitter"
+	fi
+done
+
+last=$(( $(cycles) - 1 ))
+shared=0
+for irq in 31 32 1 2; do
+	if masks_overlap "$(irq_mask $last $irq)" "$own"; then
+		shared=1
+	fi
+done
+[ $shared -eq 1 ] || fail "cpus $own not given back"
@@ -0,0 +1,18 @@
+#!/bin/sh
+# The queues of a multi queue device are spread over all cores, one
+# each, even though one core is busier than the others.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 "$data/four-cores.topo" "$data/queues.trace"
+
+last=$(( $(cycles) - 1 ))
+for core in 03 0c 30 c0; do
+	queues=0
+	for irq in 50 51 52 53; do
+		if masks_overlap "$(irq_mask $last $irq)" $core; then
+			queues=$((queues + 1))
+		fi
+	done
+	[ $queues -eq 1 ] || fail "$queues queues on the core of cpus $core"
+done
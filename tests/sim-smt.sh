@@ -0,0 +1,16 @@
+#!/bin/sh
+# High rate irqs get a physical core each before any two share one on
+# sibling threads, even when the load alone would double them up.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 --smtthresh=10000 "$data/two-cores.topo" "$data/smt.trace"
+
+last=$(( $(cycles) - 1 ))
+mask30=$(irq_mask $last 30)
+mask31=$(irq_mask $last 31)
+for core in 03 0c; do
+	if masks_overlap "$mask30" $core && masks_overlap "$mask31" $core; then
+		fail "irqs 30 and 31 share the core of cpus $core"
+	fi
+done
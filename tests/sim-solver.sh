@@ -0,0 +1,25 @@
+#!/bin/sh
+# The global solver keeps the busiest cpu less busy than the greedy
+# engine does once the loads are known, and doesn't do worse before.
+
+. "${srcdir:-.}/simlib.sh"
+
+# the highest MAXLOAD from the second placement on
+peak_load() {
+	awk '$1 == "CYCLE" { cur = $2 }
+	     cur >= 2 && $1 == "MOVED" && $6 > max { max = $6 }
+	     END { print max + 0 }' "$out"
+}
+
+run_sim -t 1 --solver=greedy "$data/two-packages.topo" "$data/solver.trace"
+greedy_first=$(cycle_stat 1 MAXLOAD)
+greedy_peak=$(peak_load)
+
+run_sim -t 1 --solver=global "$data/two-packages.topo" "$data/solver.trace"
+global_first=$(cycle_stat 1 MAXLOAD)
+global_peak=$(peak_load)
+
+[ "$global_first" -le "$greedy_first" ] ||
+	fail "first placement of the solver peaks at $global_first, greedy at $greedy_first"
+[ "$global_peak" -lt "$greedy_peak" ] ||
+	fail "solver peaks at $global_peak, greedy at $greedy_peak"
@@ -0,0 +1,26 @@
+#!/bin/sh
+# In a guest, paravirt irqs stay off the vcpus the hypervisor takes away
+# for much of the time, and the other irqs make use of them.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 "$data/guest.topo" "$data/steal.trace"
+
+last=$(( $(cycles) - 1 ))
+cycle=0
+while [ $cycle -le $last ]; do
+	for irq in 70 71 72 73; do
+		if masks_overlap "$(irq_mask $cycle $irq)" 0c; then
+			fail "paravirt irq $irq on a stolen vcpu in cycle $cycle"
+		fi
+	done
+	cycle=$((cycle + 1))
+done
+
+# the other irqs take the stolen vcpus instead, rather than paravirt irqs
+# being picked to move there and coming back every interval
+[ "$(cycle_stat $last MOVED)" -eq 0 ] || fail "$(cycle_stat $last MOVED) irqs moved in the last cycle"
+for irq in 80 81 82 83; do
+	masks_overlap "$(irq_mask $last $irq)" 0c && exit 0
+done
+fail "no irq on the stolen vcpus"
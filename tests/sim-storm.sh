@@ -0,0 +1,22 @@
+#!/bin/sh
+# An irq that starts storming is pinned to the quarantine cpus, which no
+# other irq is balanced over, and is let go after a few calm intervals.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 --storm=1000000 --quarantine=6-7 "$data/two-packages.topo" "$data/storm.trace"
+
+# the storm starts with the fourth interval and is over with the eighth
+[ "$(irq_mask 2 50)" != 000000c0 ] || fail "irq 50 quarantined before its storm"
+cycle=3
+while [ $cycle -le 8 ]; do
+	[ "$(irq_mask $cycle 50)" = 000000c0 ] ||
+		fail "irq 50 on $(irq_mask $cycle 50) in cycle $cycle, not in quarantine"
+	for irq in 30 31 32 33; do
+		if masks_overlap "$(irq_mask $cycle $irq)" c0; then
+			fail "irq $irq in quarantine in cycle $cycle"
+		fi
+	done
+	cycle=$((cycle + 1))
+done
+[ "$(irq_mask 9 50)" != 000000c0 ] || fail "irq 50 not released"
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Latency sensitive irqs stay on cpus that wake up quickly, while others
+# may still go to the sleepy ones.
+
+. "${srcdir:-.}/simlib.sh"
+
+run_sim -t 1 --wakelatency=50 "$data/sleepy.topo" "$data/wake.trace"
+
+last=$(( $(cycles) - 1 ))
+cycle=0
+while [ $cycle -le $last ]; do
+	for irq in 70 71 72 73; do
+		if masks_overlap "$(irq_mask $cycle $irq)" 0c; then
+			fail "latency sensitive irq $irq on a sleepy cpu in cycle $cycle"
+		fi
+	done
+	cycle=$((cycle + 1))
+done
+
+bulk=0
+for irq in 80 81 82 83; do
+	if masks_overlap "$(irq_mask $last $irq)" 0c; then
+		bulk=$((bulk + 1))
+	fi
+done
+[ $bulk -gt 0 ] || fail "no bulk irq on the sleepy cpus"
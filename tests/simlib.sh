@@ -0,0 +1,48 @@
+# Helpers for the checks that replay a trace through irqbalance-sim, to be
+# sourced.  SIM names the simulator and srcdir the directory of the data,
+# as automake and meson set them.
+
+SIM=${SIM:-../irqbalance-sim}
+data=${srcdir:-.}
+out=${TMPDIR:-/tmp}/irqbalance-sim.$$
+
+trap 'rm -f "$out"' EXIT
+
+fail() {
+	echo "FAIL: $*" >&2
+	exit 1
+}
+
+# run the simulator, the options first and then the topology and trace
+# files of the data directory, and keep its report
+run_sim() {
+	"$SIM" "$@" > "$out" || fail "irqbalance-sim $* exited with $?"
+}
+
+# number of cycles in the report
+cycles() {
+	awk '$1 == "CYCLE" { n++ } END { print n + 0 }' "$out"
+}
+
+# irq_mask <cycle> <irq>: the affinity of an irq at the end of a cycle
+irq_mask() {
+	awk -v cycle="$1" -v irq="$2" '
+		$1 == "CYCLE" { cur = $2 }
+		cur == cycle && $1 == "IRQ" && $2 == irq { print $NF }' "$out"
+}
+
+# cycle_stat <cycle> <MOVED | POWERSAVE | MAXLOAD | IMBALANCE>
+cycle_stat() {
+	awk -v cycle="$1" -v key="$2" '
+		$1 == "CYCLE" { cur = $2 }
+		cur == cycle && $1 == "MOVED" {
+			for (i = 1; i < NF; i += 2)
+				if ($i == key)
+					print $(i + 1)
+		}' "$out"
+}
+
+# masks_overlap <mask> <mask>: whether two affinities share a cpu
+masks_overlap() {
+	[ $(( 0x$(echo "$1" | tr -d ,) & 0x$(echo "$2" | tr -d ,) )) -ne 0 ]
+}
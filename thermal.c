@@ -15,6 +15,9 @@
 
 cpumask_t thermal_banned_cpus;
 
+/* perf capacity last reported per cpu, 0 if never reported */
+static unsigned int thermal_capacity[NR_CPUS];
+
 /* Events of thermal_genl_family */
 enum thermal_genl_event {
 	THERMAL_GENL_EVENT_UNSPEC,
@@ -354,6 +357,7 @@ static int handle_thermal_event(struct nl_msg *msg, void *arg __attribute__((unu
 	struct nlmsghdr *msnlh;
 	struct nlattr *cap;
 	int i, remain, rc;
+	gboolean capacity_changed = FALSE;
 	void *pos;
 
 	/* get actual netlink message header */
@@ -409,13 +413,33 @@ static int handle_thermal_event(struct nl_msg *msg, void *arg __attribute__((unu
 		need_to_ban = !!(!event_data[INDEX_PERF] && !event_data[INDEX_EFFI]);
 		update_banned_cpus(cur_cpuidx, need_to_ban);
 
+		/*
+		 * Anything short of a ban only changes how much load the
+		 * CPU can take, which placement adapts to without a rescan
+		 */
+		if (cur_cpuidx < NR_CPUS) {
+			thermal_capacity[cur_cpuidx] = MAX(event_data[INDEX_PERF], 1);
+			update_cpu_capacity(cur_cpuidx);
+			capacity_changed = TRUE;
+		}
+
 		log(TO_ALL, LOG_DEBUG, "thermal: event - CPU %d, perf %d, efficiency %d.\n",
 		    cur_cpuidx, event_data[INDEX_PERF], event_data[INDEX_EFFI]);
 	}
 
+	if (capacity_changed)
+		update_capacity();
+
 	return NL_OK;
 }
 
+unsigned int thermal_cpu_capacity(int cpunr)
+{
+	if (cpunr < 0 || cpunr >= NR_CPUS)
+		return 0;
+	return thermal_capacity[cpunr];
+}
+
 static int handler_for_debug(struct nl_msg *msg __attribute__((unused)),
 			     void *arg __attribute__((unused)))
 {
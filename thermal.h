@@ -7,8 +7,10 @@
 gboolean init_thermal(void);
 void deinit_thermal(void);
 extern cpumask_t thermal_banned_cpus;
+unsigned int thermal_cpu_capacity(int cpunr);
 #else
 static inline gboolean init_thermal(void) { return FALSE; }
+static inline unsigned int thermal_cpu_capacity(int cpunr __attribute__((unused))) { return 0; }
 #define deinit_thermal() do { } while (0)
 #endif
 
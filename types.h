@@ -5,10 +5,18 @@
 
 #include "cpumask.h"
 
+/*
+ * Balance levels, from the outermost to the innermost.  Every topology
+ * object carries the level it represents, an irq is placed no deeper than
+ * the first object whose level reaches the irq's own.
+ */
 #define	BALANCE_NONE		0
 #define BALANCE_PACKAGE 	1
-#define BALANCE_CACHE		2
-#define BALANCE_CORE		3
+#define BALANCE_DIE		2
+#define BALANCE_CACHE		3
+#define BALANCE_CLUSTER		4
+#define BALANCE_SMT		5
+#define BALANCE_CORE		6
 
 /*
  * IRQ Classes
@@ -22,6 +30,7 @@
 #define IRQ_GBETH       5
 #define IRQ_10GBETH     6
 #define IRQ_VIRT_EVENT  7
+#define IRQ_CLASSES     8
 
 /*
  * IRQ Types
@@ -31,10 +40,44 @@
 #define IRQ_TYPE_MSIX       2
 #define IRQ_TYPE_VIRT_EVENT 3
 
+/*
+ * How closely an irq follows the cpus of its cgroup
+ */
+#define COLOCATE_CPUS	0	/* only the cgroup's cpus */
+#define COLOCATE_CACHE	1	/* the last level caches of those cpus */
+
+/*
+ * What to make of the affinity_hint drivers give for an irq
+ */
+#define HINT_POLICY_IGNORE	0	/* balance as if there was none */
+#define HINT_POLICY_SUBSET	1	/* balance within the hinted cpus */
+#define HINT_POLICY_EXACT	2	/* apply the hint, don't balance */
+
+/*
+ * Directions of the network queue an irq serves
+ */
+#define QUEUE_RX	(1 << 0)
+#define QUEUE_TX	(1 << 1)
+
+/*
+ * Softirq groups, used to attribute softirq time to the IRQ classes
+ * that raise it.  SOFTIRQ_OTHER is not attributed to any class.
+ */
+#define SOFTIRQ_NET	0
+#define SOFTIRQ_BLOCK	1
+#define SOFTIRQ_OTHER	2
+#define SOFTIRQ_GROUPS	3
+
 /*
  * IRQ Internal tracking flags
  */
 #define IRQ_FLAG_BANNED                 (1ULL << 0)
+#define IRQ_FLAG_DEDICATED              (1ULL << 1)
+#define IRQ_FLAG_LATENCY                (1ULL << 2)
+#define IRQ_FLAG_STORM                  (1ULL << 3)
+
+/* idle states of a cpu that are sampled */
+#define CPUIDLE_STATES	10
 
 enum obj_type_e {
 	OBJ_TYPE_CPU,
@@ -46,8 +89,35 @@ enum obj_type_e {
 struct topo_obj {
 	uint64_t load;
 	uint64_t last_load;
+	uint64_t last_softirq_load;
+	uint64_t hardirq_load;
+	uint64_t app_load;		/* user, system and iowait time */
+	uint64_t last_app_load;
+	uint64_t softirq_load[SOFTIRQ_GROUPS];
+	uint64_t softirq_count[SOFTIRQ_GROUPS];
+	uint64_t last_softirq_count[SOFTIRQ_GROUPS];
+	/* interrupts handled in the last interval, weighted by their cost */
 	uint64_t irq_count;
+	uint64_t softirq_irq_count[SOFTIRQ_GROUPS];
+	/* per class interrupt counts of a cpu, fed to the cost model */
+	uint64_t class_irq_count[IRQ_CLASSES];
+	uint64_t last_class_irq_count[IRQ_CLASSES];
 	enum obj_type_e obj_type;
+	int level;		/* BALANCE_* this object represents */
+	unsigned int capacity;	/* average cpu capacity, of CAPACITY_SCALE */
+	unsigned int avail;	/* average share of time not stolen, likewise */
+	unsigned int max_capacity;	/* cpus only, capacity if never stolen */
+	uint64_t last_stat_time;	/* cpus only, /proc/stat times last seen */
+	uint64_t last_stolen_time;
+	uint64_t last_idle_time[CPUIDLE_STATES];	/* cpus only, us spent in each idle state */
+	uint64_t last_aperf;	/* cpus only, frequency counters last seen */
+	uint64_t last_mperf;
+	unsigned int max_freq;	/* cpus only, cpufreq limits in kHz, 0 if unknown */
+	unsigned int base_freq;
+	unsigned int freq_scale;	/* cpus only, frequency of the last interval, of CAPACITY_SCALE */
+	unsigned int idle;	/* share of time in idle states past polling, per mille */
+	unsigned int wake_latency;	/* us an interrupt can expect to wait for a cpu to wake up */
+	int cache_level;	/* for shared cache domains, the cache level */
 	int number;
 	int powersave_mode;
 	cpumask_t mask;
@@ -70,10 +140,24 @@ struct irq_info {
 	uint64_t irq_count;
 	uint64_t last_irq_count;
 	uint64_t load;
+	uint64_t handler_time;
 	int moved;
 	int existing;
 	struct topo_obj *assigned_obj;
 	char *name;
+	int device;		/* msi irqs of one device share an id, else 0 */
+	char *netdev;		/* network device whose queue the irq serves */
+	int queue;
+	int queue_dirs;		/* QUEUE_RX and/or QUEUE_TX, 0 for no queue */
+	char *cgroup;		/* cgroup to co-locate with, or NULL */
+	int cgroup_scope;
+	cpumask_t colocate_mask;	/* cpus the irq is kept on, empty for any */
+	int hint_policy;
+	cpumask_t affinity_hint;	/* driver's cpus for the irq, empty for none */
+	unsigned int core_share;	/* smoothed share of a core it keeps busy, of CAPACITY_SCALE */
+	int dedicated_cpu;	/* cpu of its own, with IRQ_FLAG_DEDICATED */
+	uint64_t irq_rate;	/* smoothed interrupts per second */
+	int storm_count;	/* intervals towards the start or the end of a storm */
 };
 
 #endif
@@ -107,7 +107,8 @@ void send_settings(char *data)
 char * get_data(char *string)
 {
 	/* Send "setup" to get sleep interval, banned IRQs and banned CPUs,
-	 * "stats" to get CPU tree statistics
+	 * "stats" to get CPU tree statistics, "stats depth" to get them with
+	 * the depth of every object in the tree
 	 */
 	int socket_fd;
 
@@ -292,11 +293,6 @@ void parse_into_tree(char *data)
 		}
 		new = g_malloc0(sizeof(cpu_node_t));
 		new->type = strtol(strtok_r(NULL, " ", &ptr), NULL, 10);
-		if(new->type == OBJ_TYPE_NODE) {
-			parent = NULL;
-		} else if(new->type >= parent->type) {
-			parent = parent->parent;
-		}
 		token = strtok_r(NULL, " ", &ptr);
 		if(!g_str_has_prefix(token, "NUMBER")) goto out;
 		new->number = strtol(strtok_r(NULL, " ", &ptr), NULL, 10);
@@ -307,6 +303,26 @@ void parse_into_tree(char *data)
 		if(!g_str_has_prefix(token, "SAVE_MODE")) goto out;
 		new->is_powersave = strtol(strtok_r(NULL, " ", &ptr), NULL, 10);
 		token = strtok_r(NULL, " ", &ptr);
+		new->depth = -1;
+		if(token && g_str_has_prefix(token, "DEPTH")) {
+			new->depth = strtol(strtok_r(NULL, " ", &ptr), NULL, 10);
+			token = strtok_r(NULL, " ", &ptr);
+		}
+
+		/*
+		 * nested cache domains have the same type, and may close several
+		 * levels at once; daemons that don't send the depth have a single
+		 * cache level
+		 */
+		if(new->type == OBJ_TYPE_NODE) {
+			parent = NULL;
+		} else if(new->depth >= 0) {
+			while(parent && new->depth <= parent->depth)
+				parent = parent->parent;
+		} else {
+			while(parent && new->type >= parent->type)
+				parent = parent->parent;
+		}
 
 		/* Parse assigned IRQ data */
 		while(token && g_str_has_prefix(token, "IRQ")) {
@@ -360,7 +376,7 @@ gboolean rescan_tree(gpointer data __attribute__((unused)))
 {
 	char *setup_data = get_data(SETUP);
 	parse_setup(setup_data);
-	char *irqbalance_data = get_data(STATS);
+	char *irqbalance_data = get_data(STATS_DEPTH);
 	parse_into_tree(irqbalance_data);
 	if(state == STATE_TREE) {
 		display_tree();
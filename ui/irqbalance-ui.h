@@ -11,6 +11,7 @@
 #define SOCKET_TMPFS "/run/irqbalance"
 
 #define STATS "stats"
+#define STATS_DEPTH "stats depth"
 #define SET_SLEEP "settings sleep "
 #define BAN_IRQS "settings ban irqs "
 #define SETUP "setup"
@@ -51,6 +52,7 @@ typedef struct cpu_node {
 	int number;
 	uint64_t load;
 	int is_powersave;
+	int depth;		/* in the tree, -1 if the daemon didn't say */
 	struct cpu_node *parent;
 	GList *children;
 	GList *irqs;
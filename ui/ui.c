@@ -844,7 +844,7 @@ void display_tree(void)
 	clear();
 	char *setup_data = get_data(SETUP);
 	parse_setup(setup_data);
-	char *irqbalance_data = get_data(STATS);
+	char *irqbalance_data = get_data(STATS_DEPTH);
 	parse_into_tree(irqbalance_data);
 	display_banned_cpus();
 	max_offset = 0;